@@ -0,0 +1,504 @@
+// bench.cpp --- 描画の各段階を測るベンチマーク
+// License: MIT
+// 使い方: bench [--seconds SEC] [--bpp BPP] [--png-level LEVEL] [FILE ...]
+// FILEを指定すると、合成したコーパスに加えてそのシフトJISテキストも測る。
+#include <cstdio>
+#include <chrono>
+#include <ctime>
+#include <algorithm>
+
+#include "txt2png.h"
+#include "encoding.h"
+#include "glyph_cache.h"
+#include "png.h"
+#include "pnm.h"
+#include "tiff.h"
+#include "simd.h"
+#include "session.h"
+
+namespace {
+
+// 計測に使うコーパス
+struct VskCorpus
+{
+    std::string m_name;     // 名前
+    std::string m_text;     // シフトJISのテキスト
+};
+
+// 描画モード
+struct VskBenchMode
+{
+    const char *m_name;
+    bool m_is_8801;
+    bool m_bold;
+};
+
+const VskBenchMode s_modes[] =
+{
+    { "9801",      false, false },
+    { "9801-bold", false, true  },
+    { "8801",      true,  false },
+    { "8801-bold", true,  true  },
+};
+
+double s_min_seconds = 0.3;     // 1項目あたりの最短の計測時間
+int s_png_level = 6;            // PNGの圧縮レベル
+volatile VskDword s_sink;       // 最適化で計算が消えないようにする
+
+// 再現できる疑似乱数（xorshift32）
+struct VskRandom
+{
+    VskDword m_state = 2463534242u;
+    VskDword next()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+    int range(int n) { return int(next() % VskDword(n)); }
+};
+
+// JISの全角文字をシフトJISで追加する
+void vsk_push_sjis(std::string& text, int ku, int ten)
+{
+    int j1 = ku + 0x20, j2 = ten + 0x20;
+    int s1 = ((j1 + 1) >> 1) + (j1 <= 0x5E ? 0x70 : 0xB0);
+    int s2 = j2 + ((j1 & 1) ? (j2 >= 0x60 ? 0x20 : 0x1F) : 0x7E);
+    text += char(s1);
+    text += char(s2);
+}
+
+// 合成したコーパスを作る。どれも約size_bytesバイト
+std::vector<VskCorpus> vsk_make_corpora(size_t size_bytes)
+{
+    std::vector<VskCorpus> corpora;
+    VskRandom random;
+
+    // ASCIIだけのプログラムリスト風のテキスト
+    VskCorpus ascii { "ascii" };
+    static const char *s_words[] = { "PRINT", "GOTO", "IF", "THEN", "FOR", "NEXT", "A$", "X%", "=", "+", "\"HELLO\"" };
+    for (int line = 10; ascii.m_text.size() < size_bytes; line += 10)
+    {
+        ascii.m_text += std::to_string(line);
+        int words = 2 + random.range(12);
+        for (int i = 0; i < words; ++i)
+        {
+            ascii.m_text += ' ';
+            ascii.m_text += s_words[random.range(int(_countof(s_words)))];
+        }
+        ascii.m_text += "\r\n";
+    }
+    corpora.push_back(ascii);
+
+    // 第一水準の漢字がぎっしり並んだテキスト
+    VskCorpus kanji { "kanji" };
+    while (kanji.m_text.size() < size_bytes)
+    {
+        int count = 20 + random.range(40);
+        for (int i = 0; i < count; ++i)
+            vsk_push_sjis(kanji.m_text, 16 + random.range(32), 1 + random.range(94));
+        kanji.m_text += "\r\n";
+    }
+    corpora.push_back(kanji);
+
+    // ANK、半角カナ、かな漢字の混じったテキスト
+    VskCorpus mixed { "mixed" };
+    while (mixed.m_text.size() < size_bytes)
+    {
+        int count = 10 + random.range(60);
+        for (int i = 0; i < count; ++i)
+        {
+            switch (random.range(4))
+            {
+            case 0: mixed.m_text += char(0x20 + random.range(0x5F)); break;
+            case 1: mixed.m_text += char(0xA1 + random.range(0x3F)); break;
+            case 2: vsk_push_sjis(mixed.m_text, 4, 1 + random.range(83)); break;
+            default: vsk_push_sjis(mixed.m_text, 16 + random.range(32), 1 + random.range(94)); break;
+            }
+        }
+        mixed.m_text += "\r\n";
+    }
+    corpora.push_back(mixed);
+
+    return corpora;
+}
+
+// ファイルを読み込む
+bool vsk_read_corpus(const char *filename, VskCorpus& corpus)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return false;
+    corpus.m_name = filename;
+    char buf[65536];
+    size_t size;
+    while ((size = fread(buf, 1, sizeof(buf), fp)) > 0)
+        corpus.m_text.append(buf, size);
+    fclose(fp);
+    return true;
+}
+
+// 計測結果
+struct VskTiming
+{
+    double m_seconds = 0;   // 1回あたりの時間（秒）
+    int m_runs = 0;         // 回数
+};
+
+// fnを最短時間以上くり返して1回あたりの時間を測る
+template <typename T_FN>
+VskTiming vsk_measure(T_FN fn)
+{
+    typedef std::chrono::steady_clock clock;
+    fn(); // 準備運動
+    VskTiming timing;
+    auto start = clock::now();
+    double elapsed = 0;
+    do
+    {
+        fn();
+        ++timing.m_runs;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < s_min_seconds);
+    timing.m_seconds = elapsed / timing.m_runs;
+    return timing;
+}
+
+// 1行分の結果を表示する
+void vsk_report(const char *stage, const std::string& corpus, const char *mode,
+                const VskTiming& timing, double bytes, double glyphs, double pages)
+{
+    const double sec = timing.m_seconds;
+    printf("%-10s %-10s %-10s", stage, corpus.c_str(), mode);
+    if (bytes > 0)
+        printf(" %10.2f", bytes / sec / (1024 * 1024));
+    else
+        printf(" %10s", "-");
+    if (glyphs > 0)
+        printf(" %10.2f", sec * 1e9 / glyphs);
+    else
+        printf(" %10s", "-");
+    if (pages > 0)
+        printf(" %10.3f", sec * 1e3 / pages);
+    else
+        printf(" %10s", "-");
+    printf("\n");
+}
+
+// テキスト中の文字を数える
+void vsk_count_glyphs(const std::string& text, size_t& ank, size_t& kanji)
+{
+    ank = kanji = 0;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        VskByte ch = text[i];
+        if (vsk_is_sjis_lead(ch) && i + 1 < text.size() && vsk_is_sjis_trail(text[i + 1]))
+        {
+            ++kanji;
+            ++i;
+        }
+        else if (ch != '\r' && ch != '\n')
+        {
+            ++ank;
+        }
+    }
+}
+
+// SJISの判定と変換
+void vsk_bench_decode(const VskCorpus& corpus)
+{
+    const std::string& text = corpus.m_text;
+    size_t ank, kanji;
+    vsk_count_glyphs(text, ank, kanji);
+    auto timing = vsk_measure([&]() {
+        VskDword sum = 0;
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            VskByte ch = text[i];
+            if (vsk_is_sjis_lead(ch) && i + 1 < text.size() && vsk_is_sjis_trail(text[i + 1]))
+            {
+                sum += vsk_sjis2jis(ch, text[i + 1]);
+                ++i;
+            }
+            else
+            {
+                sum += ch;
+            }
+        }
+        s_sink = sum;
+    });
+    vsk_report("decode", corpus.m_name, "-", timing, double(text.size()), double(ank + kanji), 0);
+}
+
+// ページ分割
+void vsk_bench_paginate(const VskCorpus& corpus)
+{
+    VskTextToPng text2png;
+    text2png.m_text = corpus.m_text;
+    vsk_paginate(text2png);
+    const int pages = text2png.m_total_pages;
+    auto timing = vsk_measure([&]() {
+        vsk_paginate(text2png);
+        s_sink = text2png.m_total_pages;
+    });
+    vsk_report("paginate", corpus.m_name, "-", timing, double(corpus.m_text.size()), 0, pages);
+}
+
+// グリフの描画（ページ上の位置に関係なく、キャッシュから取り出して描く）
+void vsk_bench_glyphs(const VskCorpus& corpus, const VskBenchMode& mode, int bpp)
+{
+    // 描画するグリフの並び
+    std::vector<VskWord> codes; // 0x100未満ならANK文字
+    const std::string& text = corpus.m_text;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        VskByte ch = text[i];
+        if (vsk_is_sjis_lead(ch) && i + 1 < text.size() && vsk_is_sjis_trail(text[i + 1]))
+        {
+            codes.push_back(vsk_sjis2jis(ch, text[i + 1]));
+            ++i;
+        }
+        else if (ch != '\r' && ch != '\n')
+        {
+            codes.push_back(ch);
+        }
+    }
+
+    const int cols = 120, rows = 80, char_width = mode.m_bold ? 9 : 8;
+    const int cx = cols * char_width, cy = rows * 20;
+    VskImageHandle image = vsk_create_image(cx, cy, bpp);
+    auto draw_glyph = (bpp == 32) ? vsk_draw_glyph_32bpp : (bpp == 8) ? vsk_draw_glyph_8bpp : vsk_draw_glyph_1bpp;
+
+    for (int kind = 0; kind < 2; ++kind)
+    {
+        const bool want_kanji = (kind == 1);
+        std::vector<VskWord> subset;
+        for (auto code : codes)
+        {
+            if ((code >= 0x100) == want_kanji)
+                subset.push_back(code);
+        }
+        if (subset.empty())
+            continue;
+
+        VskGlyphCache cache;
+        cache.set_mode(mode.m_is_8801, mode.m_bold, bpp);
+        auto timing = vsk_measure([&]() {
+            int x = 0, y = 0;
+            for (auto code : subset)
+            {
+                const VskGlyphTile& tile = want_kanji ? cache.kanji(code) : cache.ank(VskByte(code));
+                draw_glyph(image->m_pixels.data(), image->m_pitch, cx, cy, x * char_width, y * 20, tile);
+                x += want_kanji ? 2 : 1;
+                if (x >= cols - 1)
+                {
+                    x = 0;
+                    if (++y >= rows)
+                        y = 0;
+                }
+            }
+        });
+        vsk_report(want_kanji ? "draw-kanji" : "draw-ank", corpus.m_name, mode.m_name, timing,
+                   0, double(subset.size()), 0);
+    }
+    vsk_destroy_image(image);
+}
+
+// ページの描画と画像の符号化
+void vsk_bench_pages(const VskCorpus& corpus, const VskBenchMode& mode, int bpp)
+{
+    VskTextToPng text2png;
+    text2png.m_text = corpus.m_text;
+    text2png.m_is_8801 = mode.m_is_8801;
+    text2png.m_bold = mode.m_bold;
+    text2png.m_bpp = bpp;
+    vsk_paginate(text2png);
+    const int pages = text2png.m_total_pages;
+    size_t ank, kanji;
+    vsk_count_glyphs(corpus.m_text, ank, kanji);
+
+    std::vector<VskImageHandle> images(pages, nullptr);
+    auto raster = vsk_measure([&]() {
+        for (int page = 1; page <= pages; ++page)
+            vsk_render_page(text2png, page, images[page - 1]);
+    });
+    vsk_report("raster", corpus.m_name, mode.m_name, raster, double(corpus.m_text.size()),
+               double(ank + kanji), pages);
+
+    // PNGのほか、無圧縮のPBMとG4圧縮のTIFFも測る
+    VskPngWriter png;
+    png.set_level(s_png_level);
+    VskPnmWriter pbm;
+    VskTiffWriter tiff;
+    const struct
+    {
+        const char *m_stage;
+        VskImageWriter *m_writer;
+    } writers[] =
+    {
+        { "encode", &png },
+        { "encode-pbm", &pbm },
+        { "encode-tif", &tiff },
+    };
+    std::vector<VskByte> out;
+    for (auto& entry : writers)
+    {
+        size_t bytes = 0, raw_bytes = 0;
+        for (auto image : images)
+        {
+            out.clear();
+            entry.m_writer->write(image, out);
+            bytes += out.size();
+            raw_bytes += size_t((image->m_width + 7) / 8) * image->m_height;
+        }
+        auto encode = vsk_measure([&]() {
+            for (auto image : images)
+            {
+                out.clear();
+                entry.m_writer->write(image, out);
+            }
+        });
+        vsk_report(entry.m_stage, corpus.m_name, mode.m_name, encode, double(raw_bytes), 0, pages);
+        printf("%-10s %-10s %-10s %u bytes per page, %.1f%% of 1bpp raw\n", "", "", "",
+               unsigned(bytes / std::max(pages, 1)), 100.0 * bytes / std::max<size_t>(raw_bytes, 1));
+    }
+
+    for (auto image : images)
+        vsk_destroy_image(image);
+}
+
+// 編集に合わせた描画し直し（VskRenderSession）。テキスト全体の描画と、
+// 1文字の書き換え、すぐに元のページ割りに戻る挿入、以降のページがずれる行の挿入を比べる
+void vsk_bench_session(const VskCorpus& corpus, int bpp)
+{
+    VskTextToPng settings;
+    settings.m_bpp = bpp;
+    VskRenderSession session(settings);
+    const std::string& text = corpus.m_text;
+    size_t ank, kanji;
+    vsk_count_glyphs(text, ank, kanji);
+
+    auto full = vsk_measure([&]() {
+        session.set_text(text);
+    });
+    const int pages = session.page_count();
+    vsk_report("set-text", corpus.m_name, "9801", full, double(text.size()), double(ank + kanji), pages);
+
+    // 編集する行の先頭。テキストの中ほどにあり、8桁足しても折り返さない行を選ぶ
+    static const char s_insert[] = "REM-EDIT";
+    const size_t insert_len = sizeof(s_insert) - 1;
+    std::vector<size_t> lines;
+    for (size_t pos = text.size() / 3; pos < text.size() * 2 / 3; )
+    {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos)
+            break;
+        size_t len = end - pos;
+        if (len && text[end - 1] == '\r')
+            --len;
+        bool plain = len > 0 && len + insert_len <= size_t(settings.m_max_x);
+        for (size_t i = pos; plain && i < pos + len; ++i)
+            plain = VskByte(text[i]) >= 0x20;
+        if (plain)
+            lines.push_back(pos);
+        pos = end + 1;
+    }
+    if (lines.empty())
+        return;
+    VskRandom random;
+    std::vector<size_t> offsets;
+    for (int i = 0; i < 64; ++i)
+        offsets.push_back(lines[random.range(int(lines.size()))]);
+
+    // 編集して元に戻すのを1回とし、1回の編集あたりの時間と描き直したページ数を表示する
+    auto bench_edit = [&](const char *stage, std::string_view insert, size_t erase) {
+        size_t next = 0, edits = 0, dirty = 0;
+        auto timing = vsk_measure([&]() {
+            size_t offset = offsets[next++ % offsets.size()];
+            std::string_view current = session.m_buffer;
+            std::string removed, replacement(insert);
+            if (erase)
+            {
+                // 同じ幅の文字で書き換える。全角文字は2バイトとも書き換える
+                removed = std::string(current.substr(offset, vsk_is_sjis_lead(current[offset]) ? 2 : erase));
+                replacement.assign(removed.size(), '*');
+            }
+            session.edit(offset, removed.size(), replacement);
+            dirty += session.m_dirty_pages.size();
+            session.edit(offset, replacement.size(), removed);
+            dirty += session.m_dirty_pages.size();
+            edits += 2;
+        });
+        VskTiming per_edit = timing;
+        per_edit.m_seconds /= 2;
+        vsk_report(stage, corpus.m_name, "9801", per_edit, 0, 0, 1);
+        printf("%-10s %-10s %-10s %.1f pages redrawn per edit, %.2f%% of set-text\n", "", "", "",
+               double(dirty) / std::max<size_t>(edits, 1), 100.0 * per_edit.m_seconds / full.m_seconds);
+    };
+    bench_edit("edit-byte", std::string_view(), 1);
+    bench_edit("edit-sync", s_insert, 0);
+    bench_edit("edit-line", "REM\r\n", 0);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<VskCorpus> corpora;
+    int bpp = 1;
+    for (int iarg = 1; iarg < argc; ++iarg)
+    {
+        std::string arg = argv[iarg];
+        if (arg == "--seconds" && iarg + 1 < argc)
+        {
+            s_min_seconds = atof(argv[++iarg]);
+            continue;
+        }
+        if (arg == "--bpp" && iarg + 1 < argc)
+        {
+            bpp = atoi(argv[++iarg]);
+            continue;
+        }
+        if (arg == "--png-level" && iarg + 1 < argc)
+        {
+            s_png_level = atoi(argv[++iarg]);
+            continue;
+        }
+        if (arg == "--help")
+        {
+            printf("Usage: bench [--seconds SEC] [--bpp 32|8|1] [--png-level 0-9] [FILE ...]\n");
+            return 0;
+        }
+        VskCorpus corpus;
+        if (!vsk_read_corpus(argv[iarg], corpus))
+        {
+            fprintf(stderr, "bench: Cannot open file '%s'\n", argv[iarg]);
+            return 1;
+        }
+        corpora.push_back(corpus);
+    }
+    if (bpp != 32 && bpp != 8 && bpp != 1)
+    {
+        fprintf(stderr, "bench: Invalid bpp %d\n", bpp);
+        return 1;
+    }
+
+    // 合成したコーパスは先頭に置く
+    auto synthetic = vsk_make_corpora(256 * 1024);
+    corpora.insert(corpora.begin(), synthetic.begin(), synthetic.end());
+
+    printf("kernels: %s, bpp: %d, png level: %d\n", vsk_pixel_kernels().m_name, bpp, s_png_level);
+    printf("%-10s %-10s %-10s %10s %10s %10s\n", "stage", "corpus", "mode", "MB/s", "ns/glyph", "ms/page");
+    for (auto& corpus : corpora)
+    {
+        vsk_bench_decode(corpus);
+        vsk_bench_paginate(corpus);
+        for (auto& mode : s_modes)
+            vsk_bench_glyphs(corpus, mode, bpp);
+        for (auto& mode : s_modes)
+            vsk_bench_pages(corpus, mode, bpp);
+        vsk_bench_session(corpus, bpp);
+    }
+    return 0;
+}
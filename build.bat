@@ -1,2 +1,2 @@
-g++ -O3 -DTXT2PNG_EXE txt2png.cpp -o txt2png -lgdi32 -lgdiplus
+g++ -std=c++17 -O3 -DTXT2PNG_EXE txt2png.cpp image_writer.cpp png.cpp pnm.cpp tiff.cpp deflate.cpp thread_pool.cpp glyph_cache.cpp simd.cpp input.cpp sink.cpp font_atlas.cpp stats.cpp session.cpp sha256.cpp page_cache.cpp decoder.cpp -o txt2png -pthread -lpsapi
 strip txt2png.exe
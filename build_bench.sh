@@ -0,0 +1,2 @@
+#!/bin/sh
+g++ -std=c++17 -O3 bench.cpp txt2png.cpp image_writer.cpp png.cpp pnm.cpp tiff.cpp deflate.cpp thread_pool.cpp glyph_cache.cpp simd.cpp font_atlas.cpp stats.cpp session.cpp -o bench -pthread
@@ -0,0 +1,577 @@
+// decoder.cpp --- 入力の文字コードをシフトJISに変換する
+#include "decoder.h"
+#include "incbin.h"
+#include <algorithm>
+#include <cctype>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define VSK_SSE2
+    #include <emmintrin.h>
+#endif
+
+// UnicodeからJISへの対応表を埋め込む（mkunimapでimg/unicode.mapを作成する）
+VSK_INCBIN(vsk_unicode_map, "img/unicode.map");
+
+namespace {
+
+const VskByte VSK_ESC = 0x1B;
+
+// ISO-2022-JPの文字集合
+enum VSK_ISO2022JP_MODE
+{
+    VSK_MODE_ASCII,         // ESC ( B、ESC ( J
+    VSK_MODE_JIS0208,       // ESC $ @、ESC $ B、ESC $ ( Q
+    VSK_MODE_KANA,          // ESC ( I、SO
+    VSK_MODE_UNSUPPORTED,   // ESC $ ( Dなど（2バイトずつ〓にする）
+};
+
+// UTF-8の先頭バイトから並びの長さを引く表（0なら先頭になれない）
+struct VskUtf8Lengths
+{
+    VskByte m_length[256];
+    VskUtf8Lengths()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            if (i < 0x80)
+                m_length[i] = 1;
+            else if (0xC2 <= i && i <= 0xDF)
+                m_length[i] = 2;
+            else if (0xE0 <= i && i <= 0xEF)
+                m_length[i] = 3;
+            else if (0xF0 <= i && i <= 0xF4)
+                m_length[i] = 4;
+            else
+                m_length[i] = 0;
+        }
+    }
+};
+const VskUtf8Lengths s_utf8;
+
+// dataの先頭から続くASCII（0x80未満）のバイト数。stop_shiftならESC、SO、SIでも止まる
+inline size_t vsk_ascii_run(const VskByte *data, size_t size, bool stop_shift)
+{
+    size_t i = 0;
+#ifdef VSK_SSE2
+    // stop_shiftでなければ比較が成り立たない値にしておく
+    const __m128i esc = _mm_set1_epi8(stop_shift ? char(VSK_ESC) : char(0x80));
+    const __m128i shift = _mm_set1_epi8(stop_shift ? char(0x0E) : char(0x80));
+    const __m128i mask_fe = _mm_set1_epi8(char(0xFE));
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(v, esc), _mm_cmpeq_epi8(_mm_and_si128(v, mask_fe), shift));
+        int mask = _mm_movemask_epi8(_mm_or_si128(v, stop));
+        if (mask)
+        {
+            for (; !(mask & 1); mask >>= 1)
+                ++i;
+            return i;
+        }
+    }
+#else
+    for (; i + 8 <= size; i += 8)
+    {
+        VskDwordLong word;
+        std::memcpy(&word, data + i, 8);
+        if (word & 0x8080808080808080ULL)
+            break;
+        if (stop_shift)
+        {
+            // ESC、SO（0x0E）、SI（0x0F）のバイトが0になるようにしてから0のバイトを探す
+            VskDwordLong x = word ^ 0x1B1B1B1B1B1B1B1BULL;
+            VskDwordLong y = (word & 0xFEFEFEFEFEFEFEFEULL) ^ 0x0E0E0E0E0E0E0E0EULL;
+            if (((x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL) ||
+                ((y - 0x0101010101010101ULL) & ~y & 0x8080808080808080ULL))
+                break;
+        }
+    }
+#endif
+    for (; i < size; ++i)
+    {
+        if (data[i] >= 0x80 || (stop_shift && (data[i] == VSK_ESC || (data[i] & 0xFE) == 0x0E)))
+            break;
+    }
+    return i;
+}
+
+// JISの全角文字をシフトJISで追加する
+inline void vsk_put_jis(std::string& out, VskWord jis)
+{
+    int j1 = jis >> 8, j2 = jis & 0xFF;
+    if (j1 < 0x21 || j1 > 0x7E || j2 < 0x21 || j2 > 0x7E)
+    {
+        j1 = VSK_JIS_GETA >> 8;
+        j2 = VSK_JIS_GETA & 0xFF;
+    }
+    out += char(((j1 + 1) >> 1) + (j1 <= 0x5E ? 0x70 : 0xB0));
+    out += char(j2 + ((j1 & 1) ? (j2 >= 0x60 ? 0x20 : 0x1F) : 0x7E));
+}
+
+// vsk_unicode_to_jisの結果を追加する
+inline void vsk_put_code(std::string& out, VskWord code)
+{
+    if (!code)
+        vsk_put_jis(out, VSK_JIS_GETA);
+    else if (code < 0x100)
+        out += char(code);
+    else
+        vsk_put_jis(out, code);
+}
+
+// シフトJISとして解釈したときの不正なバイト数と、半角カナと全角文字の数
+void vsk_score_sjis(const VskByte *data, size_t size, size_t& errors, size_t& kana, size_t& pairs)
+{
+    errors = kana = pairs = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        VskByte ch = data[i];
+        if (ch < 0x80)
+            continue;
+        if (0xA1 <= ch && ch <= 0xDF)
+        {
+            ++kana;
+        }
+        else if (((0x81 <= ch && ch <= 0x9F) || (0xE0 <= ch && ch <= 0xFC)) && i + 1 < size &&
+                 ((0x40 <= data[i + 1] && data[i + 1] <= 0x7E) || (0x80 <= data[i + 1] && data[i + 1] <= 0xFC)))
+        {
+            ++pairs;
+            ++i;
+        }
+        else if (i + 1 < size)
+        {
+            ++errors;
+        }
+    }
+}
+
+// EUC-JPとして解釈したときの不正なバイト数
+size_t vsk_score_eucjp(const VskByte *data, size_t size)
+{
+    size_t errors = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        VskByte ch = data[i];
+        if (ch < 0x80)
+            continue;
+        size_t len = (ch == 0x8F) ? 3 : 2;
+        if (i + len > size)
+            break;
+        bool ok;
+        if (ch == 0x8E)
+            ok = (0xA1 <= data[i + 1] && data[i + 1] <= 0xDF);
+        else if (ch == 0x8F || (0xA1 <= ch && ch <= 0xFE))
+            ok = (0xA1 <= data[i + 1] && data[i + 1] <= 0xFE) &&
+                 (len == 2 || (0xA1 <= data[i + 2] && data[i + 2] <= 0xFE));
+        else
+            ok = false;
+        if (ok)
+            i += len - 1;
+        else
+            ++errors;
+    }
+    return errors;
+}
+
+// UTF-8として解釈したときの不正な並びと複数バイトの並びの数
+void vsk_score_utf8(const VskByte *data, size_t size, size_t& errors, size_t& sequences)
+{
+    errors = sequences = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (data[i] < 0x80)
+            continue;
+        size_t len = s_utf8.m_length[data[i]];
+        if (!len)
+        {
+            ++errors;
+            continue;
+        }
+        if (i + len > size)
+            break; // 調べる範囲の終わりで切れた
+        size_t k = 1;
+        while (k < len && (data[i + k] & 0xC0) == 0x80)
+            ++k;
+        if (k < len)
+        {
+            ++errors;
+            continue;
+        }
+        ++sequences;
+        i += len - 1;
+    }
+}
+
+} // namespace
+
+// 文字コードの名前を解釈する
+bool vsk_parse_encoding(const char *name, VSK_ENCODING& encoding)
+{
+    static const struct { const char *m_name; VSK_ENCODING m_encoding; } s_names[] =
+    {
+        { "sjis", VSK_ENCODING_SJIS },
+        { "shift_jis", VSK_ENCODING_SJIS },
+        { "cp932", VSK_ENCODING_SJIS },
+        { "utf-8", VSK_ENCODING_UTF8 },
+        { "utf8", VSK_ENCODING_UTF8 },
+        { "euc-jp", VSK_ENCODING_EUCJP },
+        { "eucjp", VSK_ENCODING_EUCJP },
+        { "iso-2022-jp", VSK_ENCODING_ISO2022JP },
+        { "jis", VSK_ENCODING_ISO2022JP },
+        { "auto", VSK_ENCODING_AUTO },
+    };
+    std::string lower = name;
+    for (auto& ch : lower)
+        ch = char(std::tolower(VskByte(ch)));
+    for (auto& entry : s_names)
+    {
+        if (lower == entry.m_name)
+        {
+            encoding = entry.m_encoding;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 文字コードの名前
+const char *vsk_encoding_name(VSK_ENCODING encoding)
+{
+    switch (encoding)
+    {
+    case VSK_ENCODING_SJIS:         return "sjis";
+    case VSK_ENCODING_UTF8:         return "utf-8";
+    case VSK_ENCODING_EUCJP:        return "euc-jp";
+    case VSK_ENCODING_ISO2022JP:    return "iso-2022-jp";
+    case VSK_ENCODING_AUTO:         return "auto";
+    }
+    return "";
+}
+
+// データの先頭から文字コードを推測する。決め手がなければシフトJIS
+VSK_ENCODING vsk_detect_encoding(const void *data, size_t size)
+{
+    auto bytes = static_cast<const VskByte *>(data);
+    if (size >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF)
+        return VSK_ENCODING_UTF8;
+
+    // 8ビットのバイトがなければASCIIかISO-2022-JP
+    bool has_8bit = false, has_escape = false;
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (bytes[i] >= 0x80)
+        {
+            has_8bit = true;
+            break;
+        }
+        if (bytes[i] == VSK_ESC && i + 2 < size &&
+            ((bytes[i + 1] == '$' && (bytes[i + 2] == 'B' || bytes[i + 2] == '@' || bytes[i + 2] == '(')) ||
+             (bytes[i + 1] == '(' && (bytes[i + 2] == 'B' || bytes[i + 2] == 'J' || bytes[i + 2] == 'I'))))
+        {
+            has_escape = true;
+        }
+    }
+    if (!has_8bit)
+        return has_escape ? VSK_ENCODING_ISO2022JP : VSK_ENCODING_SJIS;
+
+    size_t utf8_errors, utf8_sequences;
+    vsk_score_utf8(bytes, size, utf8_errors, utf8_sequences);
+    if (!utf8_errors && utf8_sequences)
+        return VSK_ENCODING_UTF8;
+
+    // EUC-JPの全角文字はシフトJISの半角カナの並びとしても正しいので、不正なバイトが同じなら
+    // 半角カナが全角文字より多いときだけEUC-JPとみなす
+    size_t sjis_errors, sjis_kana, sjis_pairs;
+    vsk_score_sjis(bytes, size, sjis_errors, sjis_kana, sjis_pairs);
+    size_t euc_errors = vsk_score_eucjp(bytes, size);
+    if (euc_errors < sjis_errors)
+        return VSK_ENCODING_EUCJP;
+    if (euc_errors == sjis_errors && sjis_kana > sjis_pairs)
+        return VSK_ENCODING_EUCJP;
+    return VSK_ENCODING_SJIS;
+}
+
+// Unicodeの文字をJISの全角文字か半角文字に変換する。対応がなければ0を返す
+VskWord vsk_unicode_to_jis(VskDword ch)
+{
+    if (ch < 0x80)
+        return VskWord(ch);
+    if (ch >= 0x10000)
+        return 0;
+    auto header = reinterpret_cast<const VskUnicodeMapHeader *>(vsk_unicode_map_begin);
+    auto pages = reinterpret_cast<const VskWord *>(header + 1);
+    VskWord page = pages[ch >> 8];
+    if (!page)
+        return 0;
+    return pages[256 + (page - 1) * 256 + (ch & 0xFF)];
+}
+
+// encodingで変換を始める
+void VskDecoder::reset(VSK_ENCODING encoding)
+{
+    assert(encoding != VSK_ENCODING_AUTO);
+    m_encoding = encoding;
+    m_pending_len = 0;
+    m_mode = VSK_MODE_ASCII;
+    m_started = false;
+}
+
+// dataを変換してoutの末尾に追加する
+void VskDecoder::decode(const void *data, size_t size, std::string& out)
+{
+    auto bytes = static_cast<const VskByte *>(data);
+    if (m_encoding == VSK_ENCODING_SJIS)
+    {
+        out.append(reinterpret_cast<const char *>(bytes), size);
+        return;
+    }
+
+    auto decode_some = [&](const VskByte *p, size_t n, bool last) -> size_t {
+        switch (m_encoding)
+        {
+        case VSK_ENCODING_UTF8:         return decode_utf8(p, n, last, out);
+        case VSK_ENCODING_EUCJP:        return decode_eucjp(p, n, last, out);
+        case VSK_ENCODING_ISO2022JP:    return decode_iso2022jp(p, n, last, out);
+        default:                        return n;
+        }
+    };
+
+    // 前回の持ち越しは後ろにいくらか足して先に変換する
+    if (m_pending_len)
+    {
+        VskByte temp[16];
+        size_t len = m_pending_len;
+        std::memcpy(temp, m_pending, len);
+        size_t take = std::min(size, sizeof(temp) - len);
+        std::memcpy(temp + len, bytes, take);
+        size_t used = decode_some(temp, len + take, false);
+        if (used < len)
+        {
+            // 足したバイトを合わせても文字が終わらなかった（take == size）
+            m_pending_len = int(len + take - used);
+            std::memmove(m_pending, temp + used, m_pending_len);
+            return;
+        }
+        bytes += used - len;
+        size -= used - len;
+        m_pending_len = 0;
+    }
+
+    size_t used = decode_some(bytes, size, false);
+    m_pending_len = int(size - used);
+    assert(m_pending_len <= int(sizeof(m_pending)));
+    std::memcpy(m_pending, bytes + used, m_pending_len);
+}
+
+// 入力の終わりで、途中で切れた文字を〓にして出力する
+void VskDecoder::finish(std::string& out)
+{
+    if (!m_pending_len)
+        return;
+    VskByte temp[sizeof(m_pending)];
+    size_t len = m_pending_len;
+    std::memcpy(temp, m_pending, len);
+    m_pending_len = 0;
+    switch (m_encoding)
+    {
+    case VSK_ENCODING_UTF8:         decode_utf8(temp, len, true, out); break;
+    case VSK_ENCODING_EUCJP:        decode_eucjp(temp, len, true, out); break;
+    case VSK_ENCODING_ISO2022JP:    decode_iso2022jp(temp, len, true, out); break;
+    default:                        out.append(reinterpret_cast<const char *>(temp), len); break;
+    }
+}
+
+// UTF-8を変換する。lastでなければ途中で切れた文字の手前までのバイト数を返す
+size_t VskDecoder::decode_utf8(const VskByte *data, size_t size, bool last, std::string& out)
+{
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t run = vsk_ascii_run(data + i, size - i, false);
+        if (run)
+        {
+            out.append(reinterpret_cast<const char *>(data + i), run);
+            i += run;
+            m_started = true;
+            continue;
+        }
+
+        size_t len = s_utf8.m_length[data[i]];
+        if (!len)
+        {
+            vsk_put_jis(out, VSK_JIS_GETA);
+            ++i;
+            m_started = true;
+            continue;
+        }
+        if (i + len > size)
+        {
+            if (!last)
+                return i;
+            len = size - i; // 下の検査で不正になる
+        }
+
+        // 後続バイトを確かめ、冗長な表現とサロゲートは不正とする
+        VskDword ch = data[i] & (0xFF >> (len + 1));
+        size_t k = 1;
+        for (; k < len && (data[i + k] & 0xC0) == 0x80; ++k)
+            ch = (ch << 6) | (data[i + k] & 0x3F);
+        static const VskDword s_min[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (k < len || len != s_utf8.m_length[data[i]] || ch < s_min[len] || (0xD800 <= ch && ch <= 0xDFFF))
+        {
+            vsk_put_jis(out, VSK_JIS_GETA);
+            i += std::max<size_t>(k, 1);
+            m_started = true;
+            continue;
+        }
+
+        // 先頭のBOMは捨てる
+        if (!(ch == 0xFEFF && !m_started))
+            vsk_put_code(out, vsk_unicode_to_jis(ch));
+        i += len;
+        m_started = true;
+    }
+    return i;
+}
+
+// EUC-JPを変換する。lastでなければ途中で切れた文字の手前までのバイト数を返す
+size_t VskDecoder::decode_eucjp(const VskByte *data, size_t size, bool last, std::string& out)
+{
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t run = vsk_ascii_run(data + i, size - i, false);
+        out.append(reinterpret_cast<const char *>(data + i), run);
+        i += run;
+        if (i >= size)
+            break;
+
+        VskByte ch = data[i];
+        size_t len = (ch == 0x8F) ? 3 : 2;
+        if (i + len > size)
+        {
+            if (!last)
+                return i;
+            vsk_put_jis(out, VSK_JIS_GETA);
+            return size;
+        }
+        VskByte b1 = data[i + 1];
+        if (0xA1 <= ch && ch <= 0xFE && 0xA1 <= b1 && b1 <= 0xFE)
+        {
+            vsk_put_jis(out, VskWord(((ch & 0x7F) << 8) | (b1 & 0x7F)));
+            i += 2;
+        }
+        else if (ch == 0x8E && 0xA1 <= b1 && b1 <= 0xDF)
+        {
+            out += char(b1); // 半角カナ
+            i += 2;
+        }
+        else if (ch == 0x8F && 0xA1 <= b1 && b1 <= 0xFE && 0xA1 <= data[i + 2] && data[i + 2] <= 0xFE)
+        {
+            vsk_put_jis(out, VSK_JIS_GETA); // JIS X 0212の補助漢字はフォントにない
+            i += 3;
+        }
+        else
+        {
+            vsk_put_jis(out, VSK_JIS_GETA);
+            ++i;
+        }
+    }
+    return i;
+}
+
+// ISO-2022-JPを変換する。lastでなければ途中で切れた文字やエスケープシーケンスの手前までのバイト数を返す。
+// 改行をまたいでも文字集合はそのまま引き継ぐ
+size_t VskDecoder::decode_iso2022jp(const VskByte *data, size_t size, bool last, std::string& out)
+{
+    size_t i = 0;
+    while (i < size)
+    {
+        VskByte ch = data[i];
+        if (ch == VSK_ESC)
+        {
+            // 知っているエスケープシーケンスなら文字集合を切り替える
+            static const struct { const char *m_seq; int m_mode; } s_escapes[] =
+            {
+                { "\x1B(B", VSK_MODE_ASCII },
+                { "\x1B(J", VSK_MODE_ASCII },
+                { "\x1B(I", VSK_MODE_KANA },
+                { "\x1B$@", VSK_MODE_JIS0208 },
+                { "\x1B$B", VSK_MODE_JIS0208 },
+                { "\x1B$(B", VSK_MODE_JIS0208 },
+                { "\x1B$(Q", VSK_MODE_JIS0208 },
+                { "\x1B$(D", VSK_MODE_UNSUPPORTED },
+                { "\x1B$(O", VSK_MODE_UNSUPPORTED },
+                { "\x1B$(P", VSK_MODE_UNSUPPORTED },
+            };
+            bool matched = false, partial = false;
+            for (auto& escape : s_escapes)
+            {
+                size_t len = std::strlen(escape.m_seq);
+                size_t avail = std::min(len, size - i);
+                if (std::memcmp(data + i, escape.m_seq, avail) != 0)
+                    continue;
+                if (avail < len)
+                {
+                    partial = true;
+                    continue;
+                }
+                m_mode = escape.m_mode;
+                i += len;
+                matched = true;
+                break;
+            }
+            if (matched)
+                continue;
+            if (partial && !last)
+                return i;
+            // 知らないエスケープシーケンスはそのまま通す
+        }
+        if (ch == 0x0E || ch == 0x0F)
+        {
+            m_mode = (ch == 0x0E) ? VSK_MODE_KANA : VSK_MODE_ASCII; // SO、SI
+            ++i;
+            continue;
+        }
+        if (ch < 0x21 || ch == 0x7F || ch >= 0x80)
+        {
+            // 制御文字と空白はどの文字集合でもそのまま、8ビットのバイトは不正
+            if (ch >= 0x80)
+                vsk_put_jis(out, VSK_JIS_GETA);
+            else
+                out += char(ch);
+            ++i;
+            continue;
+        }
+
+        switch (m_mode)
+        {
+        case VSK_MODE_ASCII:
+            {
+                size_t run = vsk_ascii_run(data + i, size - i, true);
+                out.append(reinterpret_cast<const char *>(data + i), std::max<size_t>(run, 1));
+                i += std::max<size_t>(run, 1);
+            }
+            break;
+        case VSK_MODE_KANA:
+            out += char((ch <= 0x5F) ? ch + 0x80 : ch);
+            ++i;
+            break;
+        default:
+            if (i + 2 > size)
+            {
+                if (!last)
+                    return i;
+                vsk_put_jis(out, VSK_JIS_GETA);
+                return size;
+            }
+            if (m_mode == VSK_MODE_JIS0208 && 0x21 <= data[i + 1] && data[i + 1] <= 0x7E)
+                vsk_put_jis(out, VskWord((ch << 8) | data[i + 1]));
+            else
+                vsk_put_jis(out, VSK_JIS_GETA);
+            i += 2;
+            break;
+        }
+    }
+    return i;
+}
@@ -0,0 +1,64 @@
+// decoder.h --- 入力の文字コードをシフトJISに変換する
+#pragma once
+
+#include "types.h"
+#include <string_view>
+
+// 入力の文字コード
+enum VSK_ENCODING
+{
+    VSK_ENCODING_SJIS,          // シフトJIS（変換しない）
+    VSK_ENCODING_UTF8,          // UTF-8
+    VSK_ENCODING_EUCJP,         // EUC-JP
+    VSK_ENCODING_ISO2022JP,     // ISO-2022-JP
+    VSK_ENCODING_AUTO,          // 先頭を調べて判定する
+};
+
+// 文字コードの名前を解釈する（sjis、utf-8、euc-jp、iso-2022-jp、auto）
+bool vsk_parse_encoding(const char *name, VSK_ENCODING& encoding);
+// 文字コードの名前
+const char *vsk_encoding_name(VSK_ENCODING encoding);
+// データの先頭から文字コードを推測する。決め手がなければシフトJIS
+VSK_ENCODING vsk_detect_encoding(const void *data, size_t size);
+
+// 変換できない文字の代わりに使う全角文字（〓）
+#define VSK_JIS_GETA 0x222E
+
+// Unicodeの対応表のファイル形式（数値はリトルエンディアン）:
+//   VskUnicodeMapHeader
+//   BMPの上位バイトからページ番号+1を引くVskWordの256要素の表（0ならページなし）
+//   ページ（VskWordの256要素）の並び。値が0なら対応なし、0x100未満なら半角文字、それ以外はJISの全角文字
+#define VSK_UNICODE_MAP_MAGIC "VSKUMAP1"
+
+struct VskUnicodeMapHeader
+{
+    char m_magic[8];                // VSK_UNICODE_MAP_MAGIC
+    VskDword m_page_count;          // ページ数
+    VskDword m_reserved;
+};
+
+// Unicodeの文字をJISの全角文字か半角文字に変換する。対応がなければ0を返す
+VskWord vsk_unicode_to_jis(VskDword ch);
+
+// 入力をシフトJISに変換するデコーダー。チャンクの境界で切れた文字は次の呼び出しに持ち越す。
+// 改行とASCIIはそのまま残るので、変換した結果をそのままページに分割できる
+struct VskDecoder
+{
+    VSK_ENCODING m_encoding = VSK_ENCODING_SJIS;
+    VskByte m_pending[4];           // 持ち越したバイト
+    int m_pending_len = 0;          // 持ち越したバイト数
+    int m_mode = 0;                 // ISO-2022-JPの現在の文字集合
+    bool m_started = false;         // 先頭のBOMを調べたか？
+
+    // encodingで変換を始める（VSK_ENCODING_AUTOは不可）
+    void reset(VSK_ENCODING encoding);
+    // dataを変換してoutの末尾に追加する
+    void decode(const void *data, size_t size, std::string& out);
+    // 入力の終わりで、途中で切れた文字を〓にして出力する
+    void finish(std::string& out);
+
+protected:
+    size_t decode_utf8(const VskByte *data, size_t size, bool last, std::string& out);
+    size_t decode_eucjp(const VskByte *data, size_t size, bool last, std::string& out);
+    size_t decode_iso2022jp(const VskByte *data, size_t size, bool last, std::string& out);
+};
@@ -0,0 +1,765 @@
+// deflate.cpp --- Deflate圧縮 (RFC 1951)
+#include "deflate.h"
+#include <algorithm>
+#include <queue>
+
+namespace {
+
+const int VSK_WSIZE = VSK_DEFLATE_WSIZE;    // スライド窓の大きさ
+const int VSK_WMASK = VSK_WSIZE - 1;
+const int VSK_HASH_BITS = 15;
+const int VSK_HASH_SIZE = 1 << VSK_HASH_BITS;
+const int VSK_HASH_MASK = VSK_HASH_SIZE - 1;
+const int VSK_MIN_MATCH = 3;
+const int VSK_HASH_BYTES = 4;               // ハッシュ値を計算するバイト数
+const int VSK_RUN_MIN = 8;                  // 高速なレベルで距離1の一致として出力する連続の最小長
+const int VSK_MAX_MATCH = 258;
+const int VSK_MIN_LOOKAHEAD = VSK_MAX_MATCH + VSK_MIN_MATCH + 1;
+const size_t VSK_MAX_SYMBOLS = 16384;       // ブロック当たりの最大記号数
+const size_t VSK_MAX_BLOCK_BYTES = 1 << 20; // ブロック当たりの最大入力バイト数
+
+// 圧縮レベルごとの設定（zlibと同じ値）
+struct VskLevelConfig
+{
+    int m_good;     // この長さ以上の一致があればチェーンの探索を減らす
+    int m_lazy;     // 遅延評価する最大の一致長（レベル1～3では挿入する最大の一致長）
+    int m_nice;     // この長さ以上の一致があれば探索をやめる
+    int m_chain;    // チェーンの最大探索数
+};
+const VskLevelConfig s_configs[10] =
+{
+    { 0, 0, 0, 0 },
+    { 4, 4, 8, 4 },
+    { 4, 5, 16, 8 },
+    { 4, 6, 32, 32 },
+    { 4, 4, 16, 16 },
+    { 8, 16, 32, 32 },
+    { 8, 16, 128, 128 },
+    { 8, 32, 128, 256 },
+    { 32, 128, 258, 1024 },
+    { 32, 258, 258, 4096 },
+};
+
+const int s_length_base[29] =
+{
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const int s_length_extra[29] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const int s_dist_base[30] =
+{
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const int s_dist_extra[30] =
+{
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// 符号長の符号の並び順
+const int s_cl_order[19] =
+{
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// 一致長と距離から符号を引く表
+struct VskDeflateTables
+{
+    VskByte m_length_code[VSK_MAX_MATCH + 1];
+    VskByte m_dist_code[512];
+    VskByte m_fixed_lit_len[288];
+    VskWord m_fixed_lit_code[288];
+    VskByte m_fixed_dist_len[30];
+    VskWord m_fixed_dist_code[30];
+
+    VskDeflateTables();
+
+    int dist_code(int dist) const
+    {
+        --dist;
+        return (dist < 256) ? m_dist_code[dist] : m_dist_code[256 + (dist >> 7)];
+    }
+};
+
+// ビットの並びを逆順にする
+inline VskWord vsk_reverse_bits(VskWord code, int bits)
+{
+    VskWord ret = 0;
+    while (bits-- > 0)
+    {
+        ret = VskWord((ret << 1) | (code & 1));
+        code >>= 1;
+    }
+    return ret;
+}
+
+// 符号長から正準ハフマン符号を作成する（ビット順は逆順）
+void vsk_make_codes(const VskByte *lengths, int count, VskWord *codes)
+{
+    int bl_count[16] = { 0 };
+    for (int i = 0; i < count; ++i)
+        bl_count[lengths[i]]++;
+    bl_count[0] = 0;
+
+    int next_code[16] = { 0 };
+    int code = 0;
+    for (int bits = 1; bits < 16; ++bits)
+    {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        int len = lengths[i];
+        codes[i] = (len ? vsk_reverse_bits(VskWord(next_code[len]++), len) : 0);
+    }
+}
+
+// 頻度から最大max_bitsビットのハフマン符号長を作成する
+void vsk_build_lengths(const VskDword *freq, int count, int max_bits, VskByte *lengths)
+{
+    std::fill(lengths, lengths + count, 0);
+
+    std::vector<int> syms;
+    for (int i = 0; i < count; ++i)
+    {
+        if (freq[i])
+            syms.push_back(i);
+    }
+
+    // 少なくとも2つの符号を定義する
+    if (syms.size() < 2)
+    {
+        int a = (syms.empty() ? 0 : syms[0]);
+        int b = (a == 0 ? 1 : 0);
+        lengths[a] = lengths[b] = 1;
+        return;
+    }
+
+    // ハフマン木を作る（葉は0～n-1、内部節点はその後ろ）
+    const int n = int(syms.size());
+    std::vector<int> parent(2 * n - 1, -1);
+    typedef std::pair<VskDwordLong, int> Item;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item> > heap;
+    for (int i = 0; i < n; ++i)
+        heap.push(Item(freq[syms[i]], i));
+    int next = n;
+    while (heap.size() > 1)
+    {
+        Item a = heap.top(); heap.pop();
+        Item b = heap.top(); heap.pop();
+        parent[a.second] = parent[b.second] = next;
+        heap.push(Item(a.first + b.first, next));
+        ++next;
+    }
+
+    // 根から深さを求める（親は必ず子より後ろにある）
+    std::vector<int> depth(2 * n - 1, 0);
+    for (int i = 2 * n - 3; i >= 0; --i)
+        depth[i] = depth[parent[i]] + 1;
+
+    // 長すぎる符号を切り詰め、クラフトの不等式を満たすまで調整する
+    int bl_count[16] = { 0 };
+    for (int i = 0; i < n; ++i)
+        bl_count[std::min(depth[i], max_bits)]++;
+    VskDword total = 0;
+    for (int bits = max_bits; bits >= 1; --bits)
+        total += VskDword(bl_count[bits]) << (max_bits - bits);
+    while (total > (VskDword(1) << max_bits))
+    {
+        bl_count[max_bits]--;
+        for (int bits = max_bits - 1; bits >= 1; --bits)
+        {
+            if (bl_count[bits])
+            {
+                bl_count[bits]--;
+                bl_count[bits + 1] += 2;
+                break;
+            }
+        }
+        --total;
+    }
+
+    // 頻度の低い記号から長い符号を割り当てる
+    std::stable_sort(syms.begin(), syms.end(), [&](int a, int b) {
+        return freq[a] < freq[b];
+    });
+    int k = 0;
+    for (int bits = max_bits; bits >= 1; --bits)
+    {
+        for (int j = 0; j < bl_count[bits]; ++j)
+            lengths[syms[k++]] = VskByte(bits);
+    }
+    assert(k == n);
+}
+
+VskDeflateTables::VskDeflateTables()
+{
+    for (int code = 0; code < 29; ++code)
+    {
+        int last = (code == 28) ? 1 : (1 << s_length_extra[code]);
+        for (int k = 0; k < last; ++k)
+        {
+            int len = s_length_base[code] + k;
+            if (len <= VSK_MAX_MATCH)
+                m_length_code[len] = VskByte(code);
+        }
+    }
+    m_length_code[VSK_MAX_MATCH] = 28;
+
+    for (int code = 0; code < 30; ++code)
+    {
+        for (int k = 0; k < (1 << s_dist_extra[code]); ++k)
+        {
+            int dist = s_dist_base[code] + k - 1;
+            if (dist < 256)
+                m_dist_code[dist] = VskByte(code);
+            else
+                m_dist_code[256 + (dist >> 7)] = VskByte(code);
+        }
+    }
+
+    for (int i = 0; i < 288; ++i)
+    {
+        if (i < 144)
+            m_fixed_lit_len[i] = 8;
+        else if (i < 256)
+            m_fixed_lit_len[i] = 9;
+        else if (i < 280)
+            m_fixed_lit_len[i] = 7;
+        else
+            m_fixed_lit_len[i] = 8;
+    }
+    vsk_make_codes(m_fixed_lit_len, 288, m_fixed_lit_code);
+    std::fill(m_fixed_dist_len, m_fixed_dist_len + 30, 5);
+    vsk_make_codes(m_fixed_dist_len, 30, m_fixed_dist_code);
+}
+
+const VskDeflateTables& vsk_deflate_tables()
+{
+    static const VskDeflateTables s_tables;
+    return s_tables;
+}
+
+// 4バイトのハッシュ値。1ビットの文字画像は0の多いバイト列なので、3バイトではチェーンが長くなりすぎる
+inline int vsk_hash4(const VskByte *p)
+{
+    VskDword value;
+    std::memcpy(&value, p, sizeof(value));
+    return int((value * 0x9E3779B1) >> (32 - VSK_HASH_BITS));
+}
+
+} // namespace
+
+// Adler-32を計算する
+VskDword vsk_adler32(VskDword adler, const void *data, size_t size)
+{
+    const int NMAX = 5552; // 32ビットで桁あふれしない最大の長さ
+    auto p = reinterpret_cast<const VskByte *>(data);
+    VskDword s1 = adler & 0xFFFF, s2 = adler >> 16;
+    while (size > 0)
+    {
+        size_t n = std::min<size_t>(size, NMAX);
+        size -= n;
+        while (n--)
+        {
+            s1 += *p++;
+            s2 += s1;
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+    }
+    return (s2 << 16) | s1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// VskDeflater
+
+// コンストラクタ
+VskDeflater::VskDeflater()
+{
+    m_head.resize(VSK_HASH_SIZE);
+    m_prev.resize(VSK_WSIZE);
+    m_symbols.reserve(VSK_MAX_SYMBOLS);
+    std::fill(std::begin(m_lit_freq), std::end(m_lit_freq), 0);
+    std::fill(std::begin(m_dist_freq), std::end(m_dist_freq), 0);
+}
+
+// 圧縮レベルを設定する（0は無圧縮、9は最大圧縮）
+void VskDeflater::set_level(int level)
+{
+    m_level = std::max(0, std::min(level, 9));
+}
+
+// 新しいストリームを開始する
+void VskDeflater::begin(std::vector<VskByte>& out)
+{
+    m_out = &out;
+    m_window.clear();
+    m_pos = m_block_start = m_hash_pos = 0;
+    std::fill(m_head.begin(), m_head.end(), -1);
+    m_symbols.clear();
+    std::fill(std::begin(m_lit_freq), std::end(m_lit_freq), 0);
+    std::fill(std::begin(m_dist_freq), std::end(m_dist_freq), 0);
+    m_bitbuf = 0;
+    m_bitcount = 0;
+    m_cached_pos = size_t(-1);
+}
+
+// 前のデータを辞書として与える。ハッシュ表には次の一致を探すときに追加される
+void VskDeflater::set_dictionary(const void *data, size_t size)
+{
+    assert(m_window.empty());
+    auto p = reinterpret_cast<const VskByte *>(data);
+    if (size > size_t(VSK_WSIZE))
+    {
+        p += size - VSK_WSIZE;
+        size = VSK_WSIZE;
+    }
+    m_window.assign(p, p + size);
+    m_pos = m_block_start = size;
+}
+
+// データを圧縮する
+void VskDeflater::write(const void *data, size_t size)
+{
+    slide();
+    auto p = reinterpret_cast<const VskByte *>(data);
+    m_window.insert(m_window.end(), p, p + size);
+    deflate_data(false);
+}
+
+// 同期フラッシュ。ここまでの入力をバイト境界で区切って出力する
+void VskDeflater::flush()
+{
+    deflate_data(true);
+    if (m_symbols.size() || m_pos > m_block_start)
+        emit_block(false);
+    // 空の無圧縮ブロックでバイト境界にそろえる
+    emit_stored(nullptr, 0, false);
+}
+
+// ストリームを終了する
+void VskDeflater::finish()
+{
+    deflate_data(true);
+    emit_block(true);
+    align_bits();
+}
+
+// 窓の先頭の不要な部分を捨てる
+void VskDeflater::slide()
+{
+    size_t keep_from = std::min(std::min(m_pos, m_hash_pos), m_block_start);
+    if (keep_from < 2 * VSK_WSIZE)
+        return;
+
+    // ハッシュチェーンは位置の下位ビットで引くので、窓の大きさの倍数だけずらす
+    size_t shift = (keep_from - VSK_WSIZE) & ~size_t(VSK_WMASK);
+    m_window.erase(m_window.begin(), m_window.begin() + shift);
+    m_pos -= shift;
+    m_hash_pos -= shift;
+    m_block_start -= shift;
+    if (m_cached_pos != size_t(-1))
+        m_cached_pos -= shift;
+
+    const VskLong delta = VskLong(shift);
+    for (auto& pos : m_head)
+        pos = (pos >= delta) ? pos - delta : -1;
+    for (auto& pos : m_prev)
+        pos = (pos >= delta) ? pos - delta : -1;
+}
+
+// ハッシュ表にposの文字列を追加する
+inline void VskDeflater::insert_string(size_t pos)
+{
+    int h = vsk_hash4(&m_window[pos]);
+    m_prev[pos & VSK_WMASK] = m_head[h];
+    m_head[h] = VskLong(pos);
+}
+
+// posから始まる最長一致を探す。prev_lenより長い一致がなければ0を返す
+int VskDeflater::longest_match(size_t pos, int prev_len, int& dist)
+{
+    const size_t end = m_window.size();
+
+    // まだ追加していない文字列をハッシュ表に追加する
+    for (; m_hash_pos < pos && m_hash_pos + VSK_HASH_BYTES <= end; ++m_hash_pos)
+        insert_string(m_hash_pos);
+
+    VskLong cand;
+    if (m_hash_pos == pos)
+    {
+        cand = m_head[vsk_hash4(&m_window[pos])];
+        insert_string(pos);
+        ++m_hash_pos;
+    }
+    else
+    {
+        cand = m_prev[pos & VSK_WMASK];
+    }
+
+    const VskLevelConfig& config = s_configs[m_level];
+    const int max_len = int(std::min<size_t>(VSK_MAX_MATCH, end - pos));
+    if (prev_len >= max_len)
+        return 0;
+
+    int chain = config.m_chain;
+    if (prev_len >= config.m_good)
+        chain >>= 2;
+    const int nice = std::min(config.m_nice, max_len);
+
+    const VskByte *scan = &m_window[pos];
+    int best = std::max(prev_len, VSK_MIN_MATCH - 1);
+    while (cand >= 0 && pos - size_t(cand) < VSK_WSIZE && chain-- > 0)
+    {
+        const VskByte *match = &m_window[cand];
+        if (match[best] == scan[best] && match[0] == scan[0] && match[1] == scan[1])
+        {
+            // 8バイトずつ比べる
+            int len = 2;
+            for (; len + 8 <= max_len; len += 8)
+            {
+                VskDwordLong a, b;
+                std::memcpy(&a, match + len, 8);
+                std::memcpy(&b, scan + len, 8);
+                if (a != b)
+                    break;
+            }
+            while (len < max_len && match[len] == scan[len])
+                ++len;
+            if (len > best)
+            {
+                best = len;
+                dist = int(pos - size_t(cand));
+                if (len >= nice)
+                    break;
+            }
+        }
+        VskLong next = m_prev[cand & VSK_WMASK];
+        if (next >= cand)
+            break;
+        cand = next;
+    }
+
+    return (best > std::max(prev_len, VSK_MIN_MATCH - 1)) ? best : 0;
+}
+
+// 窓の中のデータを記号に変換する。allが偽なら先読みの余地を残す
+void VskDeflater::deflate_data(bool all)
+{
+    const size_t end = m_window.size();
+
+    if (m_level == 0)
+    {
+        while (m_pos < end)
+        {
+            size_t step = std::min(end - m_pos, VSK_MAX_BLOCK_BYTES - (m_pos - m_block_start));
+            m_pos += step;
+            if (m_pos - m_block_start >= VSK_MAX_BLOCK_BYTES)
+                emit_block(false);
+        }
+        return;
+    }
+
+    const VskLevelConfig& config = s_configs[m_level];
+    const bool lazy = (m_level >= 4);
+    const size_t limit = all ? end : (end > VSK_MIN_LOOKAHEAD ? end - VSK_MIN_LOOKAHEAD : 0);
+    while (m_pos < limit)
+    {
+        int len = 0, dist = 0;
+
+        // 高速なレベルでは、白い部分などの同じバイトの連続を探索せずに距離1の一致にする
+        if (!lazy && m_pos > 0 && m_window[m_pos] == m_window[m_pos - 1])
+        {
+            const VskByte *p = &m_window[m_pos];
+            const int max_run = int(std::min<size_t>(VSK_MAX_MATCH, end - m_pos));
+            int run = 1;
+            while (run < max_run && p[run] == p[0])
+                ++run;
+            if (run >= VSK_RUN_MIN)
+            {
+                len = run;
+                dist = 1;
+            }
+        }
+
+        if (!len && m_pos + VSK_HASH_BYTES <= end)
+        {
+            if (m_cached_pos == m_pos)
+            {
+                len = m_cached_len;
+                dist = m_cached_dist;
+            }
+            else
+            {
+                len = longest_match(m_pos, 0, dist);
+            }
+        }
+
+        // 遅延評価：次の位置でもっと長い一致があればリテラルを出力する
+        if (lazy && len && len < config.m_lazy && m_pos + 1 + VSK_HASH_BYTES <= end)
+        {
+            int dist2 = 0;
+            int len2 = longest_match(m_pos + 1, len, dist2);
+            m_cached_pos = m_pos + 1;
+            m_cached_len = len2;
+            m_cached_dist = dist2;
+            if (len2 > len)
+                len = 0;
+        }
+
+        if (len)
+        {
+            m_symbols.push_back({ VskWord(len), VskWord(dist) });
+            m_lit_freq[257 + vsk_deflate_tables().m_length_code[len]]++;
+            m_dist_freq[vsk_deflate_tables().dist_code(dist)]++;
+            if (!lazy && len > config.m_lazy)
+                m_hash_pos = std::max(m_hash_pos, m_pos + len); // 長い一致の中は挿入しない
+            m_pos += len;
+        }
+        else
+        {
+            VskByte ch = m_window[m_pos];
+            m_symbols.push_back({ ch, 0 });
+            m_lit_freq[ch]++;
+            ++m_pos;
+        }
+
+        if (m_symbols.size() >= VSK_MAX_SYMBOLS || m_pos - m_block_start >= VSK_MAX_BLOCK_BYTES)
+            emit_block(false);
+    }
+}
+
+// ビットを出力する
+inline void VskDeflater::put_bits(VskDword value, int bits)
+{
+    m_bitbuf |= VskDwordLong(value) << m_bitcount;
+    m_bitcount += bits;
+    if (m_bitcount >= 32)
+    {
+        auto& out = *m_out;
+        out.push_back(VskByte(m_bitbuf));
+        out.push_back(VskByte(m_bitbuf >> 8));
+        out.push_back(VskByte(m_bitbuf >> 16));
+        out.push_back(VskByte(m_bitbuf >> 24));
+        m_bitbuf >>= 32;
+        m_bitcount -= 32;
+    }
+}
+
+// バイト境界まで0を埋めて出力する
+void VskDeflater::align_bits()
+{
+    auto& out = *m_out;
+    while (m_bitcount > 0)
+    {
+        out.push_back(VskByte(m_bitbuf));
+        m_bitbuf >>= 8;
+        m_bitcount -= 8;
+    }
+    m_bitbuf = 0;
+    m_bitcount = 0;
+}
+
+// 無圧縮ブロックを出力する
+void VskDeflater::emit_stored(const VskByte *data, size_t size, bool final)
+{
+    auto& out = *m_out;
+    do
+    {
+        size_t len = std::min<size_t>(size, 65535);
+        size -= len;
+        put_bits((final && size == 0) ? 1 : 0, 1);
+        put_bits(0, 2);
+        align_bits();
+        out.push_back(VskByte(len));
+        out.push_back(VskByte(len >> 8));
+        out.push_back(VskByte(~len));
+        out.push_back(VskByte(~len >> 8));
+        if (len)
+        {
+            out.insert(out.end(), data, data + len);
+            data += len;
+        }
+    } while (size > 0);
+}
+
+// 現在のブロックを出力する
+void VskDeflater::emit_block(bool final)
+{
+    const size_t raw_size = m_pos - m_block_start;
+    if (m_level == 0)
+    {
+        emit_stored(&m_window[0] + m_block_start, raw_size, final);
+        m_block_start = m_pos;
+        return;
+    }
+
+    const VskDeflateTables& tables = vsk_deflate_tables();
+    m_lit_freq[256] = 1; // ブロックの終わり
+
+    // 動的ハフマン符号を作る
+    VskByte lit_len[286], dist_len[30];
+    vsk_build_lengths(m_lit_freq, 286, 15, lit_len);
+    vsk_build_lengths(m_dist_freq, 30, 15, dist_len);
+
+    int hlit = 286;
+    while (hlit > 257 && lit_len[hlit - 1] == 0)
+        --hlit;
+    int hdist = 30;
+    while (hdist > 1 && dist_len[hdist - 1] == 0)
+        --hdist;
+
+    // 符号長の並びを連長圧縮する
+    VskByte all_len[286 + 30];
+    std::copy(lit_len, lit_len + hlit, all_len);
+    std::copy(dist_len, dist_len + hdist, all_len + hlit);
+    const int total = hlit + hdist;
+    std::vector<std::pair<int, int> > cl_syms; // 符号長の符号と追加ビットの値
+    VskDword cl_freq[19] = { 0 };
+    for (int i = 0; i < total; )
+    {
+        int cur = all_len[i], run = 1;
+        while (i + run < total && all_len[i + run] == cur)
+            ++run;
+        if (cur == 0)
+        {
+            while (run >= 11)
+            {
+                int r = std::min(run, 138);
+                cl_syms.push_back({ 18, r - 11 });
+                run -= r;
+                i += r;
+            }
+            if (run >= 3)
+            {
+                cl_syms.push_back({ 17, run - 3 });
+                i += run;
+                run = 0;
+            }
+        }
+        else
+        {
+            cl_syms.push_back({ cur, 0 });
+            ++i;
+            --run;
+            while (run >= 3)
+            {
+                int r = std::min(run, 6);
+                cl_syms.push_back({ 16, r - 3 });
+                run -= r;
+                i += r;
+            }
+        }
+        while (run-- > 0)
+        {
+            cl_syms.push_back({ cur, 0 });
+            ++i;
+        }
+    }
+    for (auto& item : cl_syms)
+        cl_freq[item.first]++;
+
+    VskByte cl_len[19];
+    vsk_build_lengths(cl_freq, 19, 7, cl_len);
+    int hclen = 19;
+    while (hclen > 4 && cl_len[s_cl_order[hclen - 1]] == 0)
+        --hclen;
+
+    // それぞれの方式のビット数を見積もる
+    VskDwordLong dyn_bits = 3 + 5 + 5 + 4 + 3 * hclen;
+    for (int i = 0; i < 19; ++i)
+        dyn_bits += VskDwordLong(cl_freq[i]) * cl_len[i];
+    dyn_bits += cl_freq[16] * 2 + cl_freq[17] * 3 + cl_freq[18] * 7;
+    VskDwordLong fixed_bits = 3;
+    for (int i = 0; i < 286; ++i)
+    {
+        VskDwordLong extra = (i >= 257) ? s_length_extra[i - 257] : 0;
+        dyn_bits += m_lit_freq[i] * (lit_len[i] + extra);
+        fixed_bits += m_lit_freq[i] * (tables.m_fixed_lit_len[i] + extra);
+    }
+    for (int i = 0; i < 30; ++i)
+    {
+        dyn_bits += m_dist_freq[i] * VskDwordLong(dist_len[i] + s_dist_extra[i]);
+        fixed_bits += m_dist_freq[i] * VskDwordLong(5 + s_dist_extra[i]);
+    }
+    const VskDwordLong stored_bits = (raw_size + 5 * (raw_size / 65535 + 1)) * 8 + 7;
+
+    if (stored_bits <= dyn_bits && stored_bits <= fixed_bits)
+    {
+        emit_stored(&m_window[0] + m_block_start, raw_size, final);
+    }
+    else
+    {
+        VskWord lit_code[286], dist_code[30];
+        const VskByte *lens_lit, *lens_dist;
+        const VskWord *codes_lit, *codes_dist;
+        if (dyn_bits < fixed_bits)
+        {
+            put_bits(final, 1);
+            put_bits(2, 2);
+            put_bits(hlit - 257, 5);
+            put_bits(hdist - 1, 5);
+            put_bits(hclen - 4, 4);
+            for (int i = 0; i < hclen; ++i)
+                put_bits(cl_len[s_cl_order[i]], 3);
+            VskWord cl_code[19];
+            vsk_make_codes(cl_len, 19, cl_code);
+            for (auto& item : cl_syms)
+            {
+                put_bits(cl_code[item.first], cl_len[item.first]);
+                if (item.first == 16)
+                    put_bits(item.second, 2);
+                else if (item.first == 17)
+                    put_bits(item.second, 3);
+                else if (item.first == 18)
+                    put_bits(item.second, 7);
+            }
+            vsk_make_codes(lit_len, 286, lit_code);
+            vsk_make_codes(dist_len, 30, dist_code);
+            lens_lit = lit_len;
+            lens_dist = dist_len;
+            codes_lit = lit_code;
+            codes_dist = dist_code;
+        }
+        else
+        {
+            put_bits(final, 1);
+            put_bits(1, 2);
+            lens_lit = tables.m_fixed_lit_len;
+            lens_dist = tables.m_fixed_dist_len;
+            codes_lit = tables.m_fixed_lit_code;
+            codes_dist = tables.m_fixed_dist_code;
+        }
+
+        for (auto& sym : m_symbols)
+        {
+            if (sym.m_dist == 0)
+            {
+                put_bits(codes_lit[sym.m_litlen], lens_lit[sym.m_litlen]);
+                continue;
+            }
+            int lc = tables.m_length_code[sym.m_litlen];
+            put_bits(codes_lit[257 + lc], lens_lit[257 + lc]);
+            if (s_length_extra[lc])
+                put_bits(sym.m_litlen - s_length_base[lc], s_length_extra[lc]);
+            int dc = tables.dist_code(sym.m_dist);
+            put_bits(codes_dist[dc], lens_dist[dc]);
+            if (s_dist_extra[dc])
+                put_bits(sym.m_dist - s_dist_base[dc], s_dist_extra[dc]);
+        }
+        put_bits(codes_lit[256], lens_lit[256]);
+    }
+
+    m_symbols.clear();
+    std::fill(std::begin(m_lit_freq), std::end(m_lit_freq), 0);
+    std::fill(std::begin(m_dist_freq), std::end(m_dist_freq), 0);
+    m_block_start = m_pos;
+}
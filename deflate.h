@@ -0,0 +1,65 @@
+// deflate.h --- Deflate圧縮 (RFC 1951)
+#pragma once
+
+#include "types.h"
+
+// スライド窓の大きさ。これより前のデータは一致の参照先にならない
+#define VSK_DEFLATE_WSIZE 32768
+
+// Adler-32を計算する
+VskDword vsk_adler32(VskDword adler, const void *data, size_t size);
+
+// Deflateの圧縮器。ハッシュ表やバッファはストリーム間で再利用される
+struct VskDeflater
+{
+    // 圧縮された記号（リテラルか長さと距離の組）
+    struct Symbol
+    {
+        VskWord m_litlen;   // リテラル(0～255)か一致長(3～258)
+        VskWord m_dist;     // 距離（リテラルなら0）
+    };
+
+    int m_level = 6;                        // 圧縮レベル（0～9）
+    std::vector<VskByte> *m_out = nullptr;  // 出力先
+    std::vector<VskByte> m_window;          // 入力データ（スライド窓）
+    size_t m_pos = 0;                       // 次に処理する位置
+    size_t m_block_start = 0;               // 現在のブロックの開始位置
+    size_t m_hash_pos = 0;                  // 次にハッシュ表に追加する位置
+    std::vector<VskLong> m_head;            // ハッシュの先頭
+    std::vector<VskLong> m_prev;            // ハッシュチェーン
+    std::vector<Symbol> m_symbols;          // 現在のブロックの記号
+    VskDword m_lit_freq[286];               // リテラル・長さの頻度
+    VskDword m_dist_freq[30];               // 距離の頻度
+    VskDwordLong m_bitbuf = 0;              // ビットバッファ
+    int m_bitcount = 0;                     // ビットバッファのビット数
+    size_t m_cached_pos = size_t(-1);       // 遅延評価で先読みした一致の位置
+    int m_cached_len = 0;                   // 先読みした一致長
+    int m_cached_dist = 0;                  // 先読みした距離
+
+    VskDeflater();
+
+    // 圧縮レベルを設定する（0は無圧縮、9は最大圧縮）
+    void set_level(int level);
+
+    // 新しいストリームを開始する。圧縮データはoutの末尾に追加される
+    void begin(std::vector<VskByte>& out);
+    // 前のデータを辞書として与える（beginの直後に呼ぶ）。辞書は出力せず、一致の参照先にだけ使う。
+    // 別々に圧縮したデータをつなげて1つのストリームにするときに使う
+    void set_dictionary(const void *data, size_t size);
+    // データを圧縮する
+    void write(const void *data, size_t size);
+    // 同期フラッシュ。ここまでの入力をバイト境界で区切って出力する
+    void flush();
+    // ストリームを終了する
+    void finish();
+
+protected:
+    void deflate_data(bool all);
+    int longest_match(size_t pos, int prev_len, int& dist);
+    void insert_string(size_t pos);
+    void slide();
+    void emit_block(bool final);
+    void emit_stored(const VskByte *data, size_t size, bool final);
+    void put_bits(VskDword value, int bits);
+    void align_bits();
+};
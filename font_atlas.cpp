@@ -0,0 +1,69 @@
+// font_atlas.cpp --- フォントアトラス（グリフを詰めて並べたバイナリ）
+#include "font_atlas.h"
+#include "incbin.h"
+
+// アトラスを実行ファイルに埋め込む（mkatlasでimg/font.atlasを作成する）
+VSK_INCBIN(vsk_font_atlas, "img/font.atlas");
+
+namespace {
+
+// 埋め込んだアトラスのヘッダー
+const VskFontAtlasHeader& vsk_atlas_header()
+{
+    auto header = reinterpret_cast<const VskFontAtlasHeader *>(vsk_font_atlas_begin);
+    assert(std::memcmp(header->m_magic, VSK_FONT_ATLAS_MAGIC, 8) == 0);
+    return *header;
+}
+
+} // namespace
+
+// 埋め込んだアトラス全体。sizeにバイト数を格納する
+const VskByte *vsk_atlas_data(size_t& size)
+{
+    size = vsk_font_atlas_end - vsk_font_atlas_begin;
+    return vsk_font_atlas_begin;
+}
+
+// 埋め込んだアトラスからANK文字のグリフ（16バイト）を取得する
+const VskByte *vsk_atlas_ank(bool is_8801, VskByte ch)
+{
+    const auto& header = vsk_atlas_header();
+    return vsk_font_atlas_begin + header.m_ank_offset[is_8801 ? 0 : 1] + ch * VSK_GLYPH_HEIGHT;
+}
+
+// 埋め込んだアトラスからJISの全角文字のグリフ（32バイト）を取得する
+const VskByte *vsk_atlas_kanji(VskWord jis)
+{
+    int ku = (jis >> 8) - 0x21, ten = (jis & 0xFF) - 0x21;
+    if (ku < 0 || ku >= VSK_JIS_CELLS || ten < 0 || ten >= VSK_JIS_CELLS)
+        return nullptr;
+
+    // 区点から直接グリフ番号を引く（1文字の32バイトは連続している）
+    const auto& header = vsk_atlas_header();
+    auto table = reinterpret_cast<const VskWord *>(vsk_font_atlas_begin + header.m_kanji_index_offset);
+    const VskByte *glyphs = vsk_font_atlas_begin + header.m_kanji_offset;
+    VskDword index = table[ku * VSK_JIS_CELLS + ten];
+    return glyphs + index * 2 * VSK_GLYPH_HEIGHT;
+}
+
+// フォントからANK文字のグリフを取得する（各行のビット15が左端）
+void vsk_get_ank_glyph(bool is_8801, VskByte ch, VskWord rows[VSK_GLYPH_HEIGHT])
+{
+    const VskByte *bits = vsk_atlas_ank(is_8801, ch);
+    for (int dy = 0; dy < VSK_GLYPH_HEIGHT; ++dy)
+        rows[dy] = VskWord(bits[dy] << 8);
+}
+
+// フォントからJISの全角文字のグリフを取得する（各行のビット15が左端）
+void vsk_get_kanji_glyph(VskWord jis, VskWord rows[VSK_GLYPH_HEIGHT])
+{
+    const VskByte *bits = vsk_atlas_kanji(jis);
+    if (!bits)
+    {
+        // フォントの範囲外
+        std::fill(rows, rows + VSK_GLYPH_HEIGHT, 0);
+        return;
+    }
+    for (int dy = 0; dy < VSK_GLYPH_HEIGHT; ++dy)
+        rows[dy] = VskWord((bits[2 * dy] << 8) | bits[2 * dy + 1]);
+}
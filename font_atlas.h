@@ -0,0 +1,41 @@
+// font_atlas.h --- フォントアトラス（グリフを詰めて並べたバイナリ）
+#pragma once
+
+#include "types.h"
+
+// グリフの高さ（ピクセル単位）
+#define VSK_GLYPH_HEIGHT 16
+
+// JIS X 0208の区と点の数
+#define VSK_JIS_CELLS 94
+
+// アトラスのファイル形式（数値はリトルエンディアン）:
+//   VskFontAtlasHeader（ANK文字と全角文字は64バイト境界から始まる）
+//   ANK文字（8801、9801の順に256文字ずつ。1文字16バイト、1行1バイト）
+//   全角文字の索引（区点からグリフ番号を直接引くVskWordの94x94の表）
+//   全角文字（1文字32バイト、1行2バイト）。グリフ番号0は未定義の区点の印で、
+//   その後に定義されている区点だけをJIS順に詰める
+// どの行もMSBが左端のピクセルで、ビットが立っていればインク。
+#define VSK_FONT_ATLAS_MAGIC "VSKFONT2"
+
+struct VskFontAtlasHeader
+{
+    char m_magic[8];                // VSK_FONT_ATLAS_MAGIC
+    VskDword m_ank_offset[2];       // ANK文字の位置（[0]が8801、[1]が9801）
+    VskDword m_kanji_index_offset;  // 全角文字の索引の位置
+    VskDword m_kanji_offset;        // 全角文字の位置
+    VskDword m_kanji_count;         // 全角文字の数（未定義の印を含む）
+};
+
+// 埋め込んだアトラス全体。sizeにバイト数を格納する
+const VskByte *vsk_atlas_data(size_t& size);
+// 埋め込んだアトラスからANK文字のグリフ（16バイト）を取得する
+const VskByte *vsk_atlas_ank(bool is_8801, VskByte ch);
+// 埋め込んだアトラスからJISの全角文字のグリフ（32バイト）を取得する。
+// 未定義の区点なら未定義の印を、JISの範囲外ならnullptrを返す
+const VskByte *vsk_atlas_kanji(VskWord jis);
+
+// フォントからANK文字のグリフを取得する（各行のビット15が左端）
+void vsk_get_ank_glyph(bool is_8801, VskByte ch, VskWord rows[VSK_GLYPH_HEIGHT]);
+// フォントからJISの全角文字のグリフを取得する（各行のビット15が左端）
+void vsk_get_kanji_glyph(VskWord jis, VskWord rows[VSK_GLYPH_HEIGHT]);
@@ -0,0 +1,70 @@
+// framebuffer.h --- バックエンドに依存しないフレームバッファ
+#pragma once
+
+#include "types.h"
+
+// システムの色（DIBと同じ0x00RRGGBBの並び）
+typedef VskDword VskSystemColor;
+
+#define VSK_RGB(r, g, b) \
+    ((VskSystemColor)(((VskByte)(b)) | ((VskWord)((VskByte)(g)) << 8) | ((VskDword)((VskByte)(r)) << 16)))
+
+#define VSK_COLOR_BLACK VSK_RGB(0, 0, 0)
+#define VSK_COLOR_WHITE VSK_RGB(255, 255, 255)
+
+// フレームバッファ。上から下へ並んだピクセルデータを所有する。
+// 32BPPではピクセルはVskSystemColor、8BPPではパレット番号（0が白、1が黒）、
+// 1BPPではMSBが左端でビットが立っていれば黒。
+struct VskFrameBuffer
+{
+    int m_width = 0;                // 幅（ピクセル単位）
+    int m_height = 0;               // 高さ（ピクセル単位）
+    int m_bpp = 0;                  // ビットの深さ
+    int m_pitch = 0;                // 横幅（バイト数）
+    std::vector<VskByte> m_pixels;  // ピクセルデータ
+    // 行ごとにインクがあるか（0なら白い行）。描画した関数が設定し、空なら不明。
+    // 次の描画ではインクのあった行だけを消すので、ピクセルを書き換えたら空にすること
+    std::vector<VskByte> m_ink_rows;
+
+    // y行目の先頭
+    VskByte *row(int y)
+    {
+        return m_pixels.data() + size_t(y) * m_pitch;
+    }
+    const VskByte *row(int y) const
+    {
+        return m_pixels.data() + size_t(y) * m_pitch;
+    }
+};
+
+// イメージハンドル
+typedef VskFrameBuffer *VskImageHandle;
+
+// 呼び出し側が所有するピクセルバッファ。ピクセルの形式はVskFrameBufferと同じ。
+// m_pitchを負にすれば下から上へ並んだバッファ（ボトムアップのDIBなど）も扱える
+struct VskPixelBuffer
+{
+    void *m_bits = nullptr;         // 一番上の行の先頭
+    int m_width = 0;                // 幅（ピクセル単位）
+    int m_height = 0;               // 高さ（ピクセル単位）
+    int m_bpp = 0;                  // ビットの深さ（32、8、1）
+    int m_pitch = 0;                // 次の行までのバイト数
+
+    VskPixelBuffer() { }
+    VskPixelBuffer(void *bits, int width, int height, int bpp, int pitch)
+        : m_bits(bits), m_width(width), m_height(height), m_bpp(bpp), m_pitch(pitch) { }
+    explicit VskPixelBuffer(VskFrameBuffer& image)
+        : m_bits(image.m_pixels.data()), m_width(image.m_width), m_height(image.m_height)
+        , m_bpp(image.m_bpp), m_pitch(image.m_pitch) { }
+
+    // y行目の先頭
+    VskByte *row(int y) const
+    {
+        return static_cast<VskByte *>(m_bits) + VskPtrDiff(y) * m_pitch;
+    }
+};
+
+// フレームバッファを作成する（ピクセルはゼロで初期化される）
+VskImageHandle vsk_create_image(int width, int height, int bpp);
+// フレームバッファを破棄する
+void vsk_destroy_image(VskImageHandle image);
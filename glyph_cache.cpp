@@ -0,0 +1,132 @@
+// glyph_cache.cpp --- 展開済みグリフのキャッシュ
+#include "glyph_cache.h"
+#include "simd.h"
+#include <algorithm>
+
+// コンストラクタ
+VskGlyphCache::VskGlyphCache()
+{
+    std::fill(std::begin(m_ank_ready), std::end(m_ank_ready), false);
+}
+
+// 描画モードを設定する。モードが変わったらキャッシュを捨てる
+void VskGlyphCache::set_mode(bool is_8801, bool bold, int bpp)
+{
+    if (m_is_8801 == is_8801 && m_bold == bold && m_bpp == bpp)
+        return;
+    m_is_8801 = is_8801;
+    m_bold = bold;
+    m_bpp = bpp;
+    clear();
+}
+
+// キャッシュを捨てる
+void VskGlyphCache::clear()
+{
+    std::fill(std::begin(m_ank_ready), std::end(m_ank_ready), false);
+}
+
+// グリフの行を描画モードに合わせて展開する
+void VskGlyphCache::expand(VskGlyphTile& tile, const VskWord rows[VSK_GLYPH_HEIGHT], int width)
+{
+    tile.m_width = width + (m_bold ? 1 : 0);
+    tile.m_ink_top = VSK_GLYPH_HEIGHT;
+    tile.m_ink_bottom = 0;
+    for (int y = 0; y < VSK_GLYPH_HEIGHT; ++y)
+    {
+        VskDword bits = VskDword(rows[y]) << 16;
+        if (m_bold)
+            bits |= bits >> 1; // 太字は右に1ピクセルずらして重ねる
+        tile.m_rows[y] = bits;
+        if (bits)
+        {
+            tile.m_ink_top = std::min(tile.m_ink_top, y);
+            tile.m_ink_bottom = y + 1;
+        }
+    }
+}
+
+// ANK文字のグリフ
+const VskGlyphTile& VskGlyphCache::ank(VskByte ch)
+{
+    VskGlyphTile& tile = m_ank[ch];
+    if (!m_ank_ready[ch])
+    {
+        VskWord rows[VSK_GLYPH_HEIGHT];
+        vsk_get_ank_glyph(m_is_8801, ch, rows);
+        expand(tile, rows, 8);
+        m_ank_ready[ch] = true;
+    }
+    return tile;
+}
+
+// 全角文字のグリフ
+const VskGlyphTile& VskGlyphCache::kanji(VskWord jis)
+{
+    // アトラスのグリフは連続した32バイトで直接引けるので、毎回展開するほうが速い
+    VskWord rows[VSK_GLYPH_HEIGHT];
+    vsk_get_kanji_glyph(jis, rows);
+    expand(m_kanji, rows, 16);
+    return m_kanji;
+}
+
+// グリフを32BPPのイメージに描画する。はみ出した部分は切り取る
+void vsk_draw_glyph_32bpp(VskByte *bits, int pitch, int cx, int cy, int x0, int y0, const VskGlyphTile& tile)
+{
+    const int xmin = std::max(0, -x0), xmax = std::min(tile.m_width, cx - x0);
+    const int ymin = std::max(tile.m_ink_top, -y0), ymax = std::min(tile.m_ink_bottom, cy - y0);
+    if (xmin >= xmax)
+        return;
+    const VskDrawBits32Proc draw_bits = vsk_pixel_kernels().m_draw_bits_32;
+    for (int y = ymin; y < ymax; ++y)
+    {
+        VskDword row = tile.m_rows[y] << xmin;
+        if (!row)
+            continue;
+        auto dest = reinterpret_cast<VskDword *>(bits + VskPtrDiff(y0 + y) * pitch);
+        draw_bits(dest + (x0 + xmin), row, xmax - xmin);
+    }
+}
+
+// グリフを8BPPのイメージ（0が白、1が黒）に描画する。はみ出した部分は切り取る
+void vsk_draw_glyph_8bpp(VskByte *bits, int pitch, int cx, int cy, int x0, int y0, const VskGlyphTile& tile)
+{
+    const int xmin = std::max(0, -x0), xmax = std::min(tile.m_width, cx - x0);
+    const int ymin = std::max(tile.m_ink_top, -y0), ymax = std::min(tile.m_ink_bottom, cy - y0);
+    if (xmin >= xmax)
+        return;
+    const VskDrawBits8Proc draw_bits = vsk_pixel_kernels().m_draw_bits_8;
+    for (int y = ymin; y < ymax; ++y)
+    {
+        VskDword row = tile.m_rows[y] << xmin;
+        if (!row)
+            continue;
+        VskByte *dest = bits + VskPtrDiff(y0 + y) * pitch;
+        draw_bits(dest + (x0 + xmin), row, xmax - xmin);
+    }
+}
+
+// グリフを1BPPのイメージ（MSBが左端、1が黒）に描画する。はみ出した部分は切り取る
+void vsk_draw_glyph_1bpp(VskByte *bits, int pitch, int cx, int cy, int x0, int y0, const VskGlyphTile& tile)
+{
+    const int xmin = std::max(0, -x0), xmax = std::min(tile.m_width, cx - x0);
+    const int ymin = std::max(tile.m_ink_top, -y0), ymax = std::min(tile.m_ink_bottom, cy - y0);
+    if (xmin >= xmax)
+        return;
+    // 切り取った範囲だけを残すマスク
+    const VskDword clip = (0xFFFFFFFF >> xmin) & ~(0xFFFFFFFF >> xmax);
+    const int left = x0 + xmin;             // 描画する最初のピクセル
+    const int shift = left & 7;             // バイト内の位置
+    const int nbytes = (shift + (xmax - xmin) + 7) / 8;
+    for (int y = ymin; y < ymax; ++y)
+    {
+        VskDword row = (tile.m_rows[y] & clip) << xmin;
+        if (!row)
+            continue;
+        // 左端をバイト境界からshiftビットずらし、上位からバイトごとにORする
+        VskDwordLong wide = VskDwordLong(row) << (32 - shift);
+        VskByte *dest = bits + VskPtrDiff(y0 + y) * pitch + (left >> 3);
+        for (int i = 0; i < nbytes; ++i)
+            dest[i] |= VskByte(wide >> (56 - 8 * i));
+    }
+}
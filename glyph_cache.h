@@ -0,0 +1,51 @@
+// glyph_cache.h --- 展開済みグリフのキャッシュ
+#pragma once
+
+#include "types.h"
+#include "font_atlas.h"
+
+// 描画モードに合わせて展開したグリフ
+struct VskGlyphTile
+{
+    int m_width = 0;                        // 幅（太字なら1ピクセル広い）
+    int m_ink_top = 0;                      // インクのある最初の行
+    int m_ink_bottom = 0;                   // インクのある最後の行の次（m_ink_top以下なら空白）
+    VskDword m_rows[VSK_GLYPH_HEIGHT];      // 各行のインクのビット（ビット31が左端）
+
+    // インクがまったくないか？（空白など）
+    bool is_blank() const { return m_ink_bottom <= m_ink_top; }
+};
+
+// グリフのキャッシュ。ANK文字は全部保持し、全角文字はアトラスからその都度展開する。
+// スレッドセーフではないので、スレッドごとに持つこと
+struct VskGlyphCache
+{
+    bool m_is_8801 = false;                 // 8801フォントか？
+    bool m_bold = false;                    // 太字か？
+    int m_bpp = 32;                         // 描画先のビットの深さ
+    VskGlyphTile m_ank[256];                // ANK文字
+    bool m_ank_ready[256];                  // ANK文字を展開済みか？
+    VskGlyphTile m_kanji;                   // 最後に展開した全角文字
+
+    VskGlyphCache();
+
+    // 描画モードを設定する。モードが変わったらキャッシュを捨てる
+    void set_mode(bool is_8801, bool bold, int bpp);
+    // キャッシュを捨てる
+    void clear();
+
+    // ANK文字のグリフ
+    const VskGlyphTile& ank(VskByte ch);
+    // 全角文字のグリフ。返した参照は次にkanjiを呼ぶまで有効
+    const VskGlyphTile& kanji(VskWord jis);
+
+protected:
+    void expand(VskGlyphTile& tile, const VskWord rows[VSK_GLYPH_HEIGHT], int width);
+};
+
+// グリフを32BPPのイメージに描画する。はみ出した部分は切り取る
+void vsk_draw_glyph_32bpp(VskByte *bits, int pitch, int cx, int cy, int x0, int y0, const VskGlyphTile& tile);
+// グリフを8BPPのイメージ（0が白、1が黒）に描画する。はみ出した部分は切り取る
+void vsk_draw_glyph_8bpp(VskByte *bits, int pitch, int cx, int cy, int x0, int y0, const VskGlyphTile& tile);
+// グリフを1BPPのイメージ（MSBが左端、1が黒）に描画する。はみ出した部分は切り取る
+void vsk_draw_glyph_1bpp(VskByte *bits, int pitch, int cx, int cy, int x0, int y0, const VskGlyphTile& tile);
@@ -0,0 +1,163 @@
+// image_writer.cpp --- 1ビットの行を画像ファイルに変換するエンコーダー
+#include "image_writer.h"
+#include <climits>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+// 形式の名前と拡張子
+static const struct
+{
+    VSK_IMAGE_FORMAT m_format;
+    const char *m_name;
+    const char *m_extension;
+} s_image_formats[] =
+{
+    { VSK_IMAGE_PNG, "png", ".png" },
+    { VSK_IMAGE_PBM, "pbm", ".pbm" },
+    { VSK_IMAGE_PGM, "pgm", ".pgm" },
+    { VSK_IMAGE_TIFF, "tiff", ".tif" },
+};
+
+// 形式の名前を解釈する（png、pbm、pgm、tiff）
+bool vsk_parse_image_format(const char *name, VSK_IMAGE_FORMAT& format)
+{
+    std::string lower = name;
+    for (auto& ch : lower)
+        ch = char(std::tolower(VskByte(ch)));
+    if (lower == "tif")
+        lower = "tiff";
+    for (auto& entry : s_image_formats)
+    {
+        if (lower == entry.m_name)
+        {
+            format = entry.m_format;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 形式の名前
+const char *vsk_image_format_name(VSK_IMAGE_FORMAT format)
+{
+    for (auto& entry : s_image_formats)
+    {
+        if (entry.m_format == format)
+            return entry.m_name;
+    }
+    return "";
+}
+
+// 形式の拡張子（ピリオドを含む）
+const char *vsk_image_format_extension(VSK_IMAGE_FORMAT format)
+{
+    for (auto& entry : s_image_formats)
+    {
+        if (entry.m_format == format)
+            return entry.m_extension;
+    }
+    return "";
+}
+
+// dataがその形式の画像ファイルとして途中で切れていないか？（ヘッダーと大きさだけを調べる）
+bool vsk_image_is_complete(VSK_IMAGE_FORMAT format, const std::vector<VskByte>& data)
+{
+    switch (format)
+    {
+    case VSK_IMAGE_PNG:
+        {
+            // PNGのシグネチャーで始まりIENDで終わる
+            static const VskByte s_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+            static const VskByte s_iend[12] = { 0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82 };
+            return data.size() >= sizeof(s_signature) + sizeof(s_iend) &&
+                   std::memcmp(data.data(), s_signature, sizeof(s_signature)) == 0 &&
+                   std::memcmp(data.data() + data.size() - sizeof(s_iend), s_iend, sizeof(s_iend)) == 0;
+        }
+    case VSK_IMAGE_PBM:
+    case VSK_IMAGE_PGM:
+        {
+            // ヘッダーの幅と高さから求めた大きさと一致する
+            const bool gray = (format == VSK_IMAGE_PGM);
+            std::string header(data.begin(), data.begin() + std::min<size_t>(data.size(), 64));
+            int width, height, len = 0;
+            if (std::sscanf(header.c_str(), gray ? "P5 %d %d 255%n" : "P4 %d %d%n", &width, &height, &len) != 2 ||
+                len <= 0 || width <= 0 || height <= 0)
+            {
+                return false;
+            }
+            const size_t row_size = gray ? size_t(width) : size_t(width + CHAR_BIT - 1) / CHAR_BIT;
+            return data.size() == len + 1 + row_size * height;
+        }
+    case VSK_IMAGE_TIFF:
+        {
+            // IFDが最後まである
+            if (data.size() < 8 || std::memcmp(data.data(), "II*\0", 4) != 0)
+                return false;
+            const size_t ifd = data[4] | (data[5] << 8) | (data[6] << 16) | (size_t(data[7]) << 24);
+            if (ifd < 8 || ifd + 2 > data.size())
+                return false;
+            const size_t count = data[ifd] | (data[ifd + 1] << 8);
+            return ifd + 2 + count * 12 + 4 <= data.size();
+        }
+    }
+    return false;
+}
+
+// イメージを変換してoutに格納する
+bool VskImageWriter::write(VskImageHandle image, std::vector<VskByte>& out)
+{
+    if (!image || (image->m_bpp != 1 && image->m_bpp != 8 && image->m_bpp != 32))
+        return false;
+
+    begin(image->m_width, image->m_height, out);
+
+    auto& bits = m_bits;
+    if (image->m_bpp != 1)
+        bits.resize((image->m_width + CHAR_BIT - 1) / CHAR_BIT);
+
+    // 描画したときにインクのなかった行は変換を省く
+    const bool know_ink = (int(image->m_ink_rows.size()) == image->m_height);
+    for (int y = 0; y < image->m_height; ++y)
+    {
+        if (know_ink && !image->m_ink_rows[y])
+        {
+            write_blank_row();
+            continue;
+        }
+        if (image->m_bpp == 1)
+        {
+            write_row(image->row(y));
+            continue;
+        }
+
+        std::fill(bits.begin(), bits.end(), 0);
+        if (image->m_bpp == 8)
+        {
+            // 8BPPの行を1ビットに変換する（0以外を黒とする）
+            const VskByte *row = image->row(y);
+            for (int x = 0; x < image->m_width; ++x)
+            {
+                if (row[x])
+                    bits[x / CHAR_BIT] |= VskByte(0x80 >> (x % CHAR_BIT));
+            }
+            write_row(bits.data());
+            continue;
+        }
+
+        // 32BPPの行を1ビットに変換する（暗いピクセルを黒とする）
+        auto row = reinterpret_cast<const VskDword *>(image->row(y));
+        for (int x = 0; x < image->m_width; ++x)
+        {
+            VskDword px = row[x];
+            int sum = (px & 0xFF) + ((px >> 8) & 0xFF) + ((px >> 16) & 0xFF);
+            if (sum < 3 * 0x80)
+                bits[x / CHAR_BIT] |= VskByte(0x80 >> (x % CHAR_BIT));
+        }
+        write_row(bits.data());
+    }
+
+    end();
+    return true;
+}
@@ -0,0 +1,46 @@
+// image_writer.h --- 1ビットの行を画像ファイルに変換するエンコーダー
+#pragma once
+
+#include "types.h"
+#include "framebuffer.h"
+
+// 出力する画像の形式
+enum VSK_IMAGE_FORMAT
+{
+    VSK_IMAGE_PNG,      // PNG
+    VSK_IMAGE_PBM,      // PBM（P4、無圧縮の1ビット）
+    VSK_IMAGE_PGM,      // PGM（P5、無圧縮の8ビットのグレースケール）
+    VSK_IMAGE_TIFF,     // TIFF（CCITT G4圧縮）
+};
+
+// 形式の名前を解釈する（png、pbm、pgm、tiff）
+bool vsk_parse_image_format(const char *name, VSK_IMAGE_FORMAT& format);
+// 形式の名前
+const char *vsk_image_format_name(VSK_IMAGE_FORMAT format);
+// 形式の拡張子（ピリオドを含む）
+const char *vsk_image_format_extension(VSK_IMAGE_FORMAT format);
+// dataがその形式の画像ファイルとして途中で切れていないか？（ヘッダーと大きさだけを調べる）
+bool vsk_image_is_complete(VSK_IMAGE_FORMAT format, const std::vector<VskByte>& data);
+
+// 画像のエンコーダー。begin、行の数だけwrite_rowかwrite_blank_row、endの順に呼ぶ。
+// 作業用バッファはページ間で再利用される
+struct VskImageWriter
+{
+    std::vector<VskByte> m_bits;            // 1ビットに変換した行
+
+    virtual ~VskImageWriter() { }
+
+    // 書き込みを開始する。データはoutの末尾に追加される
+    virtual void begin(int width, int height, std::vector<VskByte>& out) = 0;
+    // 1ビットの行を書き込む（MSBが左端、ビットが立っていれば黒）
+    virtual void write_row(const VskByte *bits) = 0;
+    // 白い行を書き込む
+    virtual void write_blank_row() = 0;
+    // 書き込みを終了する
+    virtual void end() = 0;
+    // 他のスレッドで圧縮にかかったCPU時間を返して0に戻す
+    virtual VskDwordLong take_helper_cpu_ns() { return 0; }
+
+    // イメージを変換してoutに格納する
+    bool write(VskImageHandle image, std::vector<VskByte>& out);
+};
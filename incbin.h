@@ -0,0 +1,32 @@
+// incbin.h --- バイナリファイルを実行ファイルに埋め込む
+#pragma once
+
+#include "types.h"
+
+// VSK_INCBIN(name, "file")はfileの内容をname_begin～name_endとして読み取り専用のセクションに置く。
+// 名前空間の外で使うこと
+#if defined(__GNUC__)
+    #if defined(_WIN32)
+        #define VSK_INCBIN_SECTION ".section .rdata,\"dr\"\n"
+    #else
+        #define VSK_INCBIN_SECTION ".section .rodata\n"
+    #endif
+    #if defined(_WIN32) && !defined(_WIN64)
+        #define VSK_INCBIN_SYMBOL(name) "_" #name
+    #else
+        #define VSK_INCBIN_SYMBOL(name) #name
+    #endif
+    #define VSK_INCBIN(name, file) \
+        __asm__( \
+            VSK_INCBIN_SECTION \
+            ".balign 64\n" \
+            VSK_INCBIN_SYMBOL(name##_begin) ":\n" \
+            ".incbin \"" file "\"\n" \
+            VSK_INCBIN_SYMBOL(name##_end) ":\n" \
+            ".previous\n" \
+        ); \
+        extern "C" const VskByte name##_begin[]; \
+        extern "C" const VskByte name##_end[]
+#else
+    #error Binary files are embedded with .incbin. Please use GCC or Clang.
+#endif
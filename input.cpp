@@ -0,0 +1,278 @@
+// input.cpp --- 入力ファイルの読み込み
+#include "input.h"
+#include <algorithm>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <io.h>
+    #include <fcntl.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// 文字コードを判定するために調べるバイト数
+#define VSK_DETECT_SIZE (64 * 1024)
+// 変換するときに一度に読み込むバイト数
+#define VSK_DECODE_CHUNK (256 * 1024)
+
+// ファイルを開く。"-"なら標準入力
+bool VskInputFile::open(const char *filename, VSK_ENCODING encoding)
+{
+    close();
+    if (!open_file(filename))
+        return false;
+
+    if (encoding == VSK_ENCODING_AUTO)
+    {
+        if (m_data)
+        {
+            encoding = vsk_detect_encoding(m_data, std::min(m_size, size_t(VSK_DETECT_SIZE)));
+        }
+        else
+        {
+            // 先読みしたバイトはあとでread_rawが最初に返す
+            m_head.resize(VSK_DETECT_SIZE);
+            size_t size = 0, got;
+            while (size < m_head.size() && (got = fread(&m_head[size], 1, m_head.size() - size, m_fp)) > 0)
+                size += got;
+            m_head.resize(size);
+            encoding = vsk_detect_encoding(m_head.data(), m_head.size());
+        }
+    }
+    m_encoding = encoding;
+    if (m_encoding != VSK_ENCODING_SJIS)
+    {
+        m_decoder.reset(m_encoding);
+        if (!m_data)
+            m_raw.resize(VSK_DECODE_CHUNK);
+    }
+    return true;
+}
+
+// ファイルを開く（文字コードは扱わない）
+bool VskInputFile::open_file(const char *filename)
+{
+    if (std::strcmp(filename, "-") == 0)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        m_fp = stdin;
+        m_owns_fp = false;
+        return true;
+    }
+
+#ifdef _WIN32
+    HANDLE hFile = ::CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                 FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (::GetFileType(hFile) == FILE_TYPE_DISK && ::GetFileSizeEx(hFile, &size) &&
+        size.QuadPart > 0 && VskDwordLong(size.QuadPart) <= SIZE_MAX)
+    {
+        HANDLE hMapping = ::CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (hMapping)
+        {
+            void *data = ::MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+            if (data)
+            {
+                m_hMapping = hMapping;
+                m_data = static_cast<const char *>(data);
+                m_size = size_t(size.QuadPart);
+            }
+            else
+            {
+                ::CloseHandle(hMapping);
+            }
+        }
+    }
+    ::CloseHandle(hFile);
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        VskDwordLong(st.st_size) <= SIZE_MAX)
+    {
+        void *data = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            ::madvise(data, size_t(st.st_size), MADV_SEQUENTIAL);
+            m_data = static_cast<const char *>(data);
+            m_size = size_t(st.st_size);
+        }
+    }
+    ::close(fd);
+#endif
+
+    if (m_data)
+        return true;
+
+    // マップできなかった（空のファイルやパイプなど）ので、少しずつ読み込む
+    m_fp = fopen(filename, "rb");
+    m_owns_fp = true;
+    return m_fp != nullptr;
+}
+
+// ファイルを閉じる
+void VskInputFile::close()
+{
+    if (m_data)
+    {
+#ifdef _WIN32
+        ::UnmapViewOfFile(m_data);
+        ::CloseHandle(m_hMapping);
+        m_hMapping = nullptr;
+#else
+        ::munmap(const_cast<char *>(m_data), m_size);
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+    if (m_fp)
+    {
+        if (m_owns_fp)
+            fclose(m_fp);
+        m_fp = nullptr;
+    }
+    m_encoding = VSK_ENCODING_SJIS;
+    m_head.clear();
+    m_head_pos = 0;
+    m_raw_pos = 0;
+    m_raw.clear();
+    m_decoded.clear();
+    m_decoded_pos = 0;
+    m_decode_finished = false;
+}
+
+// 先読みしたバイト、ファイルの順に最大sizeバイトを読み込む（変換しない）
+size_t VskInputFile::read_raw(void *buffer, size_t size)
+{
+    if (m_head_pos < m_head.size())
+    {
+        size = std::min(size, m_head.size() - m_head_pos);
+        std::memcpy(buffer, m_head.data() + m_head_pos, size);
+        m_head_pos += size;
+        return size;
+    }
+    if (!m_fp)
+        return 0;
+    return fread(buffer, 1, size, m_fp);
+}
+
+// マップしていないとき、最大sizeバイトを（シフトJISで）読み込む
+size_t VskInputFile::read(void *buffer, size_t size)
+{
+    if (m_encoding == VSK_ENCODING_SJIS)
+        return read_raw(buffer, size);
+
+    // 変換したバイトを使い切ったら次を変換する。マップしたデータは直接変換する
+    while (m_decoded_pos == m_decoded.size())
+    {
+        m_decoded.clear();
+        m_decoded_pos = 0;
+        if (m_data && m_raw_pos < m_size)
+        {
+            size_t len = std::min(m_size - m_raw_pos, size_t(VSK_DECODE_CHUNK));
+            m_decoder.decode(m_data + m_raw_pos, len, m_decoded);
+            m_raw_pos += len;
+            continue;
+        }
+        size_t len = m_data ? 0 : read_raw(m_raw.data(), m_raw.size());
+        if (len)
+        {
+            m_decoder.decode(m_raw.data(), len, m_decoded);
+            continue;
+        }
+        if (m_decode_finished)
+            return 0;
+        m_decoder.finish(m_decoded);
+        m_decode_finished = true;
+    }
+
+    size = std::min(size, m_decoded.size() - m_decoded_pos);
+    std::memcpy(buffer, m_decoded.data() + m_decoded_pos, size);
+    m_decoded_pos += size;
+    return size;
+}
+
+// 読み込みに失敗したか？
+bool VskInputFile::failed() const
+{
+    return m_fp && ferror(m_fp);
+}
+
+// コンストラクタ
+VskPageReader::VskPageReader(VskInputFile& input, int max_x, int max_y, size_t chunk_size)
+    : m_input(&input)
+    , m_paginator(max_x, max_y)
+{
+    if (!input.is_mapped())
+        m_chunk.resize(chunk_size);
+}
+
+// 次のページを取り出す
+bool VskPageReader::next(std::string_view& text, std::shared_ptr<std::string>& owned)
+{
+    if (!m_has_page)
+        return false;
+
+    size_t used;
+    if (m_input->is_mapped())
+    {
+        // ページはマップしたデータの一部をそのまま指す
+        std::string_view rest = m_input->view().substr(m_offset);
+        if (!m_started && rest.empty())
+        {
+            m_has_page = false;
+            return false;
+        }
+        m_started = true;
+        {
+            VskStageTimer timer(m_stats, VSK_STAGE_PAGINATE);
+            m_has_page = m_paginator.feed(rest, used);
+        }
+        text = rest.substr(0, used);
+        m_offset += used;
+        owned.reset();
+        return true;
+    }
+
+    // 改ページが見つかるまでバッファを読み足す
+    owned = std::make_shared<std::string>();
+    for (;;)
+    {
+        if (m_chunk_pos == m_chunk_len)
+        {
+            m_chunk_pos = 0;
+            VskStageTimer timer(m_stats, VSK_STAGE_READ);
+            m_chunk_len = m_input->read(m_chunk.data(), m_chunk.size());
+            if (!m_chunk_len)
+            {
+                m_has_page = false;
+                break;
+            }
+        }
+        m_started = true;
+        std::string_view rest(m_chunk.data() + m_chunk_pos, m_chunk_len - m_chunk_pos);
+        bool page_break;
+        {
+            VskStageTimer timer(m_stats, VSK_STAGE_PAGINATE);
+            page_break = m_paginator.feed(rest, used);
+            owned->append(rest.data(), used);
+        }
+        m_chunk_pos += used;
+        if (page_break)
+            break;
+    }
+
+    if (!m_started)
+        return false;
+    text = *owned;
+    return true;
+}
@@ -0,0 +1,74 @@
+// input.h --- 入力ファイルの読み込み
+#pragma once
+
+#include "types.h"
+#include "txt2png.h"
+#include "stats.h"
+#include "decoder.h"
+#include <cstdio>
+
+// 入力ファイル。できればメモリーマップし、できなければ少しずつ読み込む。
+// シフトJIS以外の文字コードなら、読み込みながらシフトJISに変換する
+struct VskInputFile
+{
+    FILE *m_fp = nullptr;               // マップできなかったときのファイル
+    bool m_owns_fp = false;             // m_fpを閉じるか？（標準入力なら閉じない）
+    const char *m_data = nullptr;       // マップしたデータ
+    size_t m_size = 0;                  // マップしたデータのサイズ
+#ifdef _WIN32
+    void *m_hMapping = nullptr;         // ファイルマッピングのハンドル
+#endif
+    VSK_ENCODING m_encoding = VSK_ENCODING_SJIS; // 入力の文字コード
+    VskDecoder m_decoder;               // シフトJISへの変換器
+    std::string m_head;                 // 文字コードを判定するために先読みしたバイト
+    size_t m_head_pos = 0;              // m_headの次の位置
+    size_t m_raw_pos = 0;               // 変換するとき、マップしたデータの次の位置
+    std::vector<char> m_raw;            // 変換するときの読み込み用のバッファ
+    std::string m_decoded;              // 変換したがまだ読み出していないバイト
+    size_t m_decoded_pos = 0;           // m_decodedの次の位置
+    bool m_decode_finished = false;     // 変換器に入力の終わりを伝えたか？
+
+    VskInputFile() { }
+    VskInputFile(const VskInputFile&) = delete;
+    VskInputFile& operator=(const VskInputFile&) = delete;
+    ~VskInputFile() { close(); }
+
+    // ファイルを開く。"-"なら標準入力。VSK_ENCODING_AUTOなら先頭を調べて文字コードを判定する
+    bool open(const char *filename, VSK_ENCODING encoding = VSK_ENCODING_SJIS);
+    // ファイルを閉じる
+    void close();
+
+    // メモリーマップしたシフトJISのファイルか？（viewでそのまま読める）
+    bool is_mapped() const { return m_data != nullptr && m_encoding == VSK_ENCODING_SJIS; }
+    // マップした内容
+    std::string_view view() const { return std::string_view(m_data, m_size); }
+    // マップしていないとき、最大sizeバイトを（シフトJISで）読み込む。終わりなら0を返す
+    size_t read(void *buffer, size_t size);
+    // 読み込みに失敗したか？
+    bool failed() const;
+
+protected:
+    bool open_file(const char *filename);
+    size_t read_raw(void *buffer, size_t size);
+};
+
+// 入力ファイルからページを1つずつ切り出す。
+// マップしたファイルならページはその一部を指し、そうでなければ読み込んだバイトを所有する
+struct VskPageReader
+{
+    VskInputFile *m_input;
+    VskPaginator m_paginator;
+    size_t m_offset = 0;                // マップしたデータの次の位置
+    std::vector<char> m_chunk;          // 読み込み用のバッファ
+    size_t m_chunk_pos = 0;             // バッファの次の位置
+    size_t m_chunk_len = 0;             // バッファの有効なバイト数
+    bool m_has_page = true;             // 次のページがあるか？
+    bool m_started = false;             // 1バイトでも読んだか？
+    VskStats *m_stats = nullptr;        // 読み込みとページ分割の時間を加算する（省略可）
+
+    VskPageReader(VskInputFile& input, int max_x, int max_y, size_t chunk_size = 1024 * 1024);
+
+    // 次のページを取り出してtextに格納する。ページがなければfalseを返す。
+    // マップしていないときはページのバイトをownedに格納し、textはそれを指す
+    bool next(std::string_view& text, std::shared_ptr<std::string>& owned);
+};
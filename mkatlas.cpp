@@ -0,0 +1,131 @@
+// mkatlas.cpp --- XBMからフォントアトラスを作成する
+// License: MIT
+// ビルド: g++ -O2 mkatlas.cpp -o mkatlas
+// 使い方: mkatlas img/font.atlas
+#include "font_atlas.h"
+#include <cstdio>
+#include <array>
+#include <algorithm>
+
+#include "img/pc88_chars.xbm"
+#include "img/pc98_chars.xbm"
+#include "img/kanji_chars.xbm"
+
+// XBMは1バイト中でLSBが左端なので、MSBが左端になるように逆順にする
+static VskByte vsk_reverse_bits(VskByte x)
+{
+    VskByte ret = 0;
+    for (int i = 0; i < 8; ++i, x >>= 1)
+        ret = VskByte((ret << 1) | (x & 1));
+    return ret;
+}
+
+// 数値をリトルエンディアンで追加する
+static void vsk_push_le32(std::vector<VskByte>& data, VskDword value)
+{
+    for (int i = 0; i < 4; ++i)
+        data.push_back(VskByte(value >> (8 * i)));
+}
+
+// ANK文字を追加する（128x256ピクセルの表に16x16文字）
+static void vsk_add_ank(std::vector<VskByte>& data, const unsigned char *bits, int width, int height)
+{
+    assert(width == 128 && height == 256);
+    const int bytes_per_line = width / 8;
+    for (int ch = 0; ch < 256; ++ch)
+    {
+        int xSrc = (ch & 0xF) * 8, ySrc = (ch >> 4) * 16;
+        for (int dy = 0; dy < VSK_GLYPH_HEIGHT; ++dy)
+            data.push_back(vsk_reverse_bits(bits[(ySrc + dy) * bytes_per_line + xSrc / 8]));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: mkatlas OUTPUT\n");
+        return 1;
+    }
+
+    static_assert(kanji_chars_width == 16 * VSK_JIS_CELLS, "");
+    static_assert(kanji_chars_height == 16 * VSK_JIS_CELLS, "");
+    const int bytes_per_line = kanji_chars_width / 8;
+
+    // 区点ごとのグリフを切り出す
+    typedef std::array<VskByte, 2 * VSK_GLYPH_HEIGHT> Glyph;
+    std::vector<Glyph> cells(VSK_JIS_CELLS * VSK_JIS_CELLS);
+    std::map<Glyph, int> histogram;
+    for (int ku = 0; ku < VSK_JIS_CELLS; ++ku)
+    {
+        for (int ten = 0; ten < VSK_JIS_CELLS; ++ten)
+        {
+            Glyph& glyph = cells[ku * VSK_JIS_CELLS + ten];
+            for (int dy = 0; dy < VSK_GLYPH_HEIGHT; ++dy)
+            {
+                const unsigned char *line = &kanji_chars_bits[(ku * 16 + dy) * bytes_per_line + ten * 2];
+                glyph[2 * dy + 0] = vsk_reverse_bits(line[0]);
+                glyph[2 * dy + 1] = vsk_reverse_bits(line[1]);
+            }
+            ++histogram[glyph];
+        }
+    }
+
+    // 未定義の区点はどれも同じ印のグリフなので、最も多いグリフを未定義とみなして先頭に1つだけ置く
+    Glyph missing = std::max_element(histogram.begin(), histogram.end(),
+        [](const std::pair<const Glyph, int>& a, const std::pair<const Glyph, int>& b) {
+            return a.second < b.second;
+        })->first;
+    std::vector<VskByte> kanji(missing.begin(), missing.end());
+
+    // 定義されている区点のグリフだけをJIS順に詰め、区点からグリフ番号を引く表を作る
+    std::vector<VskWord> index(VSK_JIS_CELLS * VSK_JIS_CELLS, 0);
+    VskDword count = 1;
+    for (int cell = 0; cell < VSK_JIS_CELLS * VSK_JIS_CELLS; ++cell)
+    {
+        const Glyph& glyph = cells[cell];
+        if (glyph == missing)
+            continue;
+        index[cell] = VskWord(count++);
+        kanji.insert(kanji.end(), glyph.begin(), glyph.end());
+    }
+
+    // ヘッダー、ANK文字、索引、全角文字の順に並べる
+    // グリフがキャッシュラインをまたがないよう、ANK文字と全角文字は64バイト境界にそろえる
+    const VskDword align = 64;
+    const VskDword header_size = (sizeof(VskFontAtlasHeader) + align - 1) / align * align;
+    const VskDword ank_size = 256 * VSK_GLYPH_HEIGHT;
+    const VskDword index_size = (VSK_JIS_CELLS * VSK_JIS_CELLS * sizeof(VskWord) + align - 1) / align * align;
+    std::vector<VskByte> data(VSK_FONT_ATLAS_MAGIC, VSK_FONT_ATLAS_MAGIC + 8);
+    vsk_push_le32(data, header_size);
+    vsk_push_le32(data, header_size + ank_size);
+    vsk_push_le32(data, header_size + 2 * ank_size);
+    vsk_push_le32(data, header_size + 2 * ank_size + index_size);
+    vsk_push_le32(data, count);
+    data.resize(header_size);
+    vsk_add_ank(data, pc88_chars_bits, pc88_chars_width, pc88_chars_height);
+    vsk_add_ank(data, pc98_chars_bits, pc98_chars_width, pc98_chars_height);
+    for (auto number : index)
+    {
+        data.push_back(VskByte(number));
+        data.push_back(VskByte(number >> 8));
+    }
+    data.resize(header_size + 2 * ank_size + index_size);
+    data.insert(data.end(), kanji.begin(), kanji.end());
+
+    FILE *fout = fopen(argv[1], "wb");
+    if (!fout)
+    {
+        fprintf(stderr, "mkatlas: Cannot open file '%s'\n", argv[1]);
+        return 1;
+    }
+    bool ok = fwrite(data.data(), data.size(), 1, fout) == 1;
+    ok = (fclose(fout) == 0) && ok;
+    if (!ok)
+    {
+        fprintf(stderr, "mkatlas: Cannot write file '%s'\n", argv[1]);
+        return 1;
+    }
+    printf("%u kanji, %u bytes\n", unsigned(count - 1), unsigned(data.size()));
+    return 0;
+}
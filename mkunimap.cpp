@@ -0,0 +1,135 @@
+// mkunimap.cpp --- UnicodeからJISへの対応表を作成する
+// License: MIT
+// ビルド: g++ -O2 mkunimap.cpp -o mkunimap （glibcなどiconvのある環境で）
+// 使い方: mkunimap img/font.atlas img/unicode.map
+#include "decoder.h"
+#include "font_atlas.h"
+#include <cstdio>
+#include <algorithm>
+#include <iconv.h>
+
+// 数値をリトルエンディアンで追加する
+static void vsk_push_le(std::vector<VskByte>& data, VskDword value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+        data.push_back(VskByte(value >> (8 * i)));
+}
+
+// SJISの2バイトをiconvでUnicodeの1文字に変換する。変換できなければ0を返す
+static VskDword vsk_sjis_to_unicode(iconv_t cd, VskByte lead, VskByte trail)
+{
+    char in[2] = { char(lead), char(trail) };
+    VskByte out[8];
+    char *pin = in, *pout = reinterpret_cast<char *>(out);
+    size_t in_left = 2, out_left = sizeof(out);
+    iconv(cd, nullptr, nullptr, nullptr, nullptr);
+    if (iconv(cd, &pin, &in_left, &pout, &out_left) == size_t(-1) || in_left || out_left != 4)
+        return 0;
+    return out[0] | (out[1] << 8) | (out[2] << 16) | (VskDword(out[3]) << 24);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: mkunimap FONT_ATLAS OUTPUT\n");
+        return 1;
+    }
+
+    // フォントに定義されている区点を調べる
+    FILE *fp = fopen(argv[1], "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "mkunimap: Cannot open file '%s'\n", argv[1]);
+        return 1;
+    }
+    std::vector<VskByte> atlas;
+    VskByte buf[65536];
+    size_t size;
+    while ((size = fread(buf, 1, sizeof(buf), fp)) > 0)
+        atlas.insert(atlas.end(), buf, buf + size);
+    fclose(fp);
+    VskFontAtlasHeader header;
+    std::memcpy(&header, atlas.data(), sizeof(header));
+    if (std::memcmp(header.m_magic, VSK_FONT_ATLAS_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "mkunimap: '%s' is not a font atlas\n", argv[1]);
+        return 1;
+    }
+    auto defined = [&](int ku, int ten) {
+        VskWord index;
+        std::memcpy(&index, &atlas[header.m_kanji_index_offset + 2 * (ku * VSK_JIS_CELLS + ten)], 2);
+        return index != 0;
+    };
+
+    // Unicodeの文字ごとにJISの区点を決める。シフトJISとCP932で別のUnicodeになる文字は両方を登録し、
+    // 同じ文字が複数の区点にある（NEC選定IBM拡張文字など）ときはフォントにある区点を優先する
+    std::vector<VskWord> map(0x10000, 0);
+    for (const char *charset : { "SHIFT_JIS", "CP932" })
+    {
+        iconv_t cd = iconv_open("UTF-32LE", charset);
+        if (cd == iconv_t(-1))
+        {
+            fprintf(stderr, "mkunimap: iconv does not support %s\n", charset);
+            return 1;
+        }
+        for (int ku = 0; ku < VSK_JIS_CELLS; ++ku)
+        {
+            for (int ten = 0; ten < VSK_JIS_CELLS; ++ten)
+            {
+                int j1 = ku + 0x21, j2 = ten + 0x21;
+                VskByte lead = VskByte(((j1 + 1) >> 1) + (j1 <= 0x5E ? 0x70 : 0xB0));
+                VskByte trail = VskByte(j2 + ((j1 & 1) ? (j2 >= 0x60 ? 0x20 : 0x1F) : 0x7E));
+                VskDword ch = vsk_sjis_to_unicode(cd, lead, trail);
+                if (!ch || ch >= 0x10000)
+                    continue;
+                VskWord& entry = map[ch];
+                VskWord jis = VskWord((j1 << 8) | j2);
+                if (!entry || (!defined((entry >> 8) - 0x21, (entry & 0xFF) - 0x21) && defined(ku, ten)))
+                    entry = jis;
+            }
+        }
+        iconv_close(cd);
+    }
+
+    // 半角カナと、シフトJISで0x5Cと0x7Eに割り当てられている記号
+    for (int ch = 0xA1; ch <= 0xDF; ++ch)
+        map[0xFF61 + (ch - 0xA1)] = VskWord(ch);
+    map[0x00A5] = 0x5C;
+    map[0x203E] = 0x7E;
+
+    // ASCIIはデコーダーがそのまま通すので表には入れない
+    for (int ch = 0; ch < 0x80; ++ch)
+        map[ch] = 0;
+
+    // 対応のあるページだけを出力する
+    std::vector<VskByte> data(sizeof(VskUnicodeMapHeader), 0);
+    std::memcpy(data.data(), VSK_UNICODE_MAP_MAGIC, 8);
+    std::vector<VskWord> pages(256, 0);
+    VskDword page_count = 0;
+    for (int page = 0; page < 256; ++page)
+    {
+        if (std::any_of(&map[page * 256], &map[page * 256] + 256, [](VskWord w) { return w != 0; }))
+            pages[page] = VskWord(++page_count);
+    }
+    for (int page = 0; page < 256; ++page)
+        vsk_push_le(data, pages[page], 2);
+    for (int page = 0; page < 256; ++page)
+    {
+        if (!pages[page])
+            continue;
+        for (int i = 0; i < 256; ++i)
+            vsk_push_le(data, map[page * 256 + i], 2);
+    }
+    std::memcpy(&data[8], &page_count, 4);
+
+    fp = fopen(argv[2], "wb");
+    if (!fp || fwrite(data.data(), data.size(), 1, fp) != 1 || fclose(fp) != 0)
+    {
+        fprintf(stderr, "mkunimap: Cannot write file '%s'\n", argv[2]);
+        return 1;
+    }
+    size_t mapped = std::count_if(map.begin(), map.end(), [](VskWord w) { return w != 0; });
+    printf("%u pages, %u characters, %u bytes\n", unsigned(page_count), unsigned(mapped), unsigned(data.size()));
+    return 0;
+}
@@ -0,0 +1,120 @@
+// page_cache.cpp --- ページのディスクキャッシュ（--cache-dir）
+#include "page_cache.h"
+#include "sha256.h"
+#include "font_atlas.h"
+#include <atomic>
+#include <thread>
+#include <filesystem>
+#include <cstdio>
+#ifdef _WIN32
+    #include <process.h>
+    #define vsk_getpid _getpid
+#else
+    #include <unistd.h>
+    #define vsk_getpid getpid
+#endif
+
+// キーの形式が変わったら番号を上げる
+#define VSK_PAGE_CACHE_VERSION "txt2png-page-cache-1"
+
+// キャッシュのディレクトリを開く（なければ作る）
+bool VskPageCache::open(const std::string& dir, const std::string& salt)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (!std::filesystem::is_directory(dir, ec))
+        return false;
+    m_dir = dir;
+
+    // フォントが変わったら別のキーになるよう、アトラスのハッシュも混ぜる
+    size_t atlas_size;
+    const VskByte *atlas = vsk_atlas_data(atlas_size);
+    VskSha256 sha;
+    sha.update(atlas, atlas_size);
+    VskByte digest[32];
+    sha.finish(digest);
+    m_salt = VSK_PAGE_CACHE_VERSION "\n" + salt + "\nfont=" + vsk_hex_digest(digest) + "\n";
+    return true;
+}
+
+// ページのテキストのキー（SHA-256の16進数）
+std::string VskPageCache::key(std::string_view text) const
+{
+    VskSha256 sha;
+    sha.update(m_salt.data(), m_salt.size());
+    sha.update(text.data(), text.size());
+    VskByte digest[32];
+    sha.finish(digest);
+    return vsk_hex_digest(digest);
+}
+
+// キーに対応するエントリーのパス。先頭の2文字でディレクトリを分ける
+std::string VskPageCache::path(const std::string& key) const
+{
+    return (std::filesystem::path(m_dir) / key.substr(0, 2) / (key + vsk_image_format_extension(m_format))).string();
+}
+
+// エントリーがあればそのパスとサイズを格納してtrueを返す
+bool VskPageCache::find(const std::string& key, std::string& path, VskDwordLong& size) const
+{
+    path = this->path(key);
+    std::error_code ec;
+    size = std::filesystem::file_size(path, ec);
+    return !ec && size > 0;
+}
+
+// エントリーを読み込む
+bool VskPageCache::load(const std::string& key, std::vector<VskByte>& data) const
+{
+    FILE *fp = fopen(path(key).c_str(), "rb");
+    if (!fp)
+        return false;
+    data.clear();
+    VskByte buf[65536];
+    size_t size;
+    while ((size = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.insert(data.end(), buf, buf + size);
+    bool ok = !ferror(fp);
+    fclose(fp);
+
+    // 途中で切れた画像は使わない
+    return ok && vsk_image_is_complete(m_format, data);
+}
+
+// エントリーを保存する。すでにあれば何もしない
+bool VskPageCache::store(const std::string& key, const std::vector<VskByte>& data) const
+{
+    std::string final_path;
+    VskDwordLong size;
+    if (find(key, final_path, size))
+        return true;
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(final_path).parent_path(), ec);
+
+    // 同じディレクトリの一時ファイルに書いてから名前を変える。
+    // 名前の変更はアトミックなので、他のプロセスが書きかけのエントリーを読むことはない
+    static std::atomic<unsigned> s_counter { 0 };
+    char suffix[64];
+    std::snprintf(suffix, sizeof(suffix), ".%d.%u.%u.tmp", int(vsk_getpid()),
+                  unsigned(std::hash<std::thread::id>()(std::this_thread::get_id())), unsigned(s_counter++));
+    std::string temp_path = final_path + suffix;
+
+    FILE *fp = fopen(temp_path.c_str(), "wb");
+    if (!fp)
+        return false;
+    bool ok = data.empty() || fwrite(data.data(), data.size(), 1, fp) == 1;
+    ok = (fclose(fp) == 0) && ok;
+    if (ok)
+    {
+        std::filesystem::rename(temp_path, final_path, ec);
+        ok = !ec;
+    }
+    if (!ok)
+    {
+        std::filesystem::remove(temp_path, ec);
+        // 他のプロセスが先に同じエントリーを作っていれば成功とみなす
+        ok = find(key, final_path, size);
+    }
+    return ok;
+}
@@ -0,0 +1,31 @@
+// page_cache.h --- ページのディスクキャッシュ（--cache-dir）
+#pragma once
+
+#include "types.h"
+#include "image_writer.h"
+#include <string_view>
+
+// ページのテキストと描画の設定から引く、変換済みの画像ファイルのキャッシュ。
+// エントリーは一時ファイルに書いてから名前を変えるので、複数のプロセスで共有できる。
+// エントリーは一度作ったら書き換えない
+struct VskPageCache
+{
+    std::string m_dir;              // キャッシュのディレクトリ
+    std::string m_salt;             // キーに混ぜる設定の文字列
+    VSK_IMAGE_FORMAT m_format = VSK_IMAGE_PNG; // エントリーの画像の形式
+
+    // キャッシュのディレクトリを開く（なければ作る）。saltは出力を左右する設定
+    bool open(const std::string& dir, const std::string& salt);
+
+    // ページのテキストのキー（SHA-256の16進数）
+    std::string key(std::string_view text) const;
+    // キーに対応するエントリーのパス
+    std::string path(const std::string& key) const;
+
+    // エントリーがあればそのパスとサイズを格納してtrueを返す
+    bool find(const std::string& key, std::string& path, VskDwordLong& size) const;
+    // エントリーを読み込む
+    bool load(const std::string& key, std::vector<VskByte>& data) const;
+    // エントリーを保存する。すでにあれば何もしない
+    bool store(const std::string& key, const std::vector<VskByte>& data) const;
+};
@@ -0,0 +1,298 @@
+// png.cpp --- PNGエンコーダー
+#include "png.h"
+#include "stats.h"
+#include <climits>
+#include <algorithm>
+
+namespace {
+
+// IDATチャンクの大きさの目安
+const size_t VSK_IDAT_CHUNK_SIZE = 64 * 1024;
+
+// CRC-32の表
+struct VskCrcTable
+{
+    VskDword m_table[256];
+
+    VskCrcTable()
+    {
+        for (VskDword n = 0; n < 256; ++n)
+        {
+            VskDword c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            m_table[n] = c;
+        }
+    }
+};
+
+const VskCrcTable& vsk_crc_table()
+{
+    static const VskCrcTable s_table;
+    return s_table;
+}
+
+// ビッグエンディアンで32ビット値を追加する
+inline void vsk_push_be32(std::vector<VskByte>& data, VskDword value)
+{
+    data.push_back(VskByte(value >> 24));
+    data.push_back(VskByte(value >> 16));
+    data.push_back(VskByte(value >> 8));
+    data.push_back(VskByte(value));
+}
+
+} // namespace
+
+// CRC-32を計算する
+VskDword vsk_crc32(VskDword crc, const void *data, size_t size)
+{
+    const VskDword *table = vsk_crc_table().m_table;
+    auto p = reinterpret_cast<const VskByte *>(data);
+    crc = ~crc;
+    while (size--)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// VskPngWriter
+
+// 圧縮レベルを設定する（0～9）
+void VskPngWriter::set_level(int level)
+{
+    m_deflater.set_level(level);
+}
+
+// チャンクを書き込む
+void VskPngWriter::write_chunk(const char *type, const VskByte *data, size_t size)
+{
+    auto& out = *m_out;
+    vsk_push_be32(out, VskDword(size));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (size)
+        out.insert(out.end(), data, data + size);
+    vsk_push_be32(out, vsk_crc32(0, &out[start], out.size() - start));
+}
+
+// 溜まった圧縮データをIDATチャンクとして書き込む
+void VskPngWriter::flush_idat(bool all)
+{
+    if (m_idat.empty() || (!all && m_idat.size() < VSK_IDAT_CHUNK_SIZE))
+        return;
+    write_chunk("IDAT", m_idat.data(), m_idat.size());
+    m_idat.clear();
+}
+
+// PNGの書き込みを開始する
+void VskPngWriter::begin(int width, int height, std::vector<VskByte>& out)
+{
+    m_out = &out;
+    m_width = width;
+    m_height = height;
+    m_rows = 0;
+    m_adler = 1;
+
+    static const VskByte signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    out.insert(out.end(), signature, signature + 8);
+
+    VskByte ihdr[13];
+    ihdr[0] = VskByte(width >> 24);
+    ihdr[1] = VskByte(width >> 16);
+    ihdr[2] = VskByte(width >> 8);
+    ihdr[3] = VskByte(width);
+    ihdr[4] = VskByte(height >> 24);
+    ihdr[5] = VskByte(height >> 16);
+    ihdr[6] = VskByte(height >> 8);
+    ihdr[7] = VskByte(height);
+    ihdr[8] = 1;                                        // ビットの深さ
+    ihdr[9] = (m_format == VSK_PNG_PALETTE1) ? 3 : 0;   // カラータイプ
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;                 // 圧縮、フィルタ、インターレース
+    write_chunk("IHDR", ihdr, sizeof(ihdr));
+
+    if (m_format == VSK_PNG_PALETTE1)
+    {
+        static const VskByte palette[6] = { 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00 };
+        write_chunk("PLTE", palette, sizeof(palette));
+    }
+
+    // zlibのヘッダー
+    const int level = m_deflater.m_level;
+    int flevel = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+    int cmf = 0x78, flg = flevel << 6;
+    flg += 31 - (cmf * 256 + flg) % 31;
+    m_idat.clear();
+    m_idat.push_back(VskByte(cmf));
+    m_idat.push_back(VskByte(flg));
+    m_deflater.begin(m_idat);
+
+    m_row.resize(1 + (width + CHAR_BIT - 1) / CHAR_BIT);
+    m_row_blank = false;
+
+    m_band.clear();
+    m_tail.clear();
+    m_bands_submitted = m_bands_written = 0;
+    if (m_pool)
+    {
+        // 先行する帯の数を制限してメモリー使用量を抑える
+        m_bands.resize(2 * m_pool->size());
+        for (auto& band : m_bands)
+        {
+            if (!band)
+                band.reset(new VskPngBand);
+        }
+        m_band_deflaters.resize(m_pool->size());
+    }
+}
+
+// m_rowを圧縮する
+void VskPngWriter::put_row()
+{
+    m_adler = vsk_adler32(m_adler, m_row.data(), m_row.size());
+    if (m_pool)
+    {
+        m_band.insert(m_band.end(), m_row.begin(), m_row.end());
+        if (m_band.size() >= m_band_size)
+            submit_band(false);
+    }
+    else
+    {
+        m_deflater.write(m_row.data(), m_row.size());
+    }
+    ++m_rows;
+    flush_idat(false);
+}
+
+// 溜まった行を帯としてスレッドプールで圧縮する。最後の帯でなければ同期フラッシュで終える
+void VskPngWriter::submit_band(bool final)
+{
+    const size_t ring = m_bands.size();
+    if (m_bands_submitted - m_bands_written >= ring)
+        collect_band();
+
+    VskPngBand& band = *m_bands[m_bands_submitted % ring];
+    ++m_bands_submitted;
+    band.m_dict = m_tail;
+    if (m_band.size() >= VSK_DEFLATE_WSIZE)
+    {
+        m_tail.assign(m_band.end() - VSK_DEFLATE_WSIZE, m_band.end());
+    }
+    else
+    {
+        m_tail.insert(m_tail.end(), m_band.begin(), m_band.end());
+        if (m_tail.size() > VSK_DEFLATE_WSIZE)
+            m_tail.erase(m_tail.begin(), m_tail.end() - VSK_DEFLATE_WSIZE);
+    }
+    band.m_data.swap(m_band);
+    m_band.clear();
+    band.m_out.clear();
+    band.m_final = final;
+    band.m_done = false;
+
+    const int level = m_deflater.m_level;
+    m_pool->submit([this, &band, level](int worker) {
+        const VskDwordLong cpu_ns = vsk_thread_cpu_ns();
+        VskDeflater& deflater = m_band_deflaters[worker];
+        deflater.set_level(level);
+        deflater.begin(band.m_out);
+        if (band.m_dict.size())
+            deflater.set_dictionary(band.m_dict.data(), band.m_dict.size());
+        deflater.write(band.m_data.data(), band.m_data.size());
+        if (band.m_final)
+            deflater.finish();
+        else
+            deflater.flush();
+        band.m_cpu_ns = vsk_thread_cpu_ns() - cpu_ns;
+
+        std::lock_guard<std::mutex> lock(m_band_mutex);
+        band.m_done = true;
+        m_band_cond.notify_all();
+    });
+}
+
+// 最も古い帯の圧縮が終わるのを待って、IDATに追加する
+void VskPngWriter::collect_band()
+{
+    VskPngBand& band = *m_bands[m_bands_written % m_bands.size()];
+    {
+        std::unique_lock<std::mutex> lock(m_band_mutex);
+        m_band_cond.wait(lock, [&] { return band.m_done; });
+    }
+    ++m_bands_written;
+    m_band_cpu_ns += band.m_cpu_ns;
+    m_idat.insert(m_idat.end(), band.m_out.begin(), band.m_out.end());
+    flush_idat(false);
+}
+
+// 1ビットの行を書き込む（MSBが左端、ビットが立っていれば黒）
+void VskPngWriter::write_row(const VskByte *bits)
+{
+    assert(m_rows < m_height);
+    const size_t size = m_row.size() - 1;
+    m_row_blank = false;
+    m_row[0] = 0; // フィルタなし
+    if (m_format == VSK_PNG_PALETTE1)
+    {
+        std::copy(bits, bits + size, &m_row[1]);
+    }
+    else
+    {
+        for (size_t i = 0; i < size; ++i)
+            m_row[1 + i] = VskByte(~bits[i]);
+    }
+
+    // 右端の余りのビットは0にする
+    if (int rest = m_width % CHAR_BIT)
+        m_row[size] &= VskByte(0xFF << (CHAR_BIT - rest));
+
+    put_row();
+}
+
+// 白い行を書き込む。続けて呼ばれたら前の行をそのまま使う
+void VskPngWriter::write_blank_row()
+{
+    assert(m_rows < m_height);
+    if (!m_row_blank)
+    {
+        m_row[0] = 0; // フィルタなし
+        const VskByte white = (m_format == VSK_PNG_PALETTE1) ? 0x00 : 0xFF;
+        std::fill(m_row.begin() + 1, m_row.end(), white);
+        if (int rest = m_width % CHAR_BIT)
+            m_row.back() &= VskByte(0xFF << (CHAR_BIT - rest));
+        m_row_blank = true;
+    }
+
+    put_row();
+}
+
+// PNGの書き込みを終了する
+void VskPngWriter::end()
+{
+    assert(m_rows == m_height);
+    if (m_pool && m_bands_submitted)
+    {
+        submit_band(true);
+        while (m_bands_written < m_bands_submitted)
+            collect_band();
+    }
+    else
+    {
+        // 1つの帯に収まる画像は並列にしないときと同じように圧縮する
+        if (m_band.size())
+            m_deflater.write(m_band.data(), m_band.size());
+        m_band.clear();
+        m_deflater.finish();
+    }
+    vsk_push_be32(m_idat, m_adler);
+    flush_idat(true);
+    write_chunk("IEND", nullptr, 0);
+    m_out = nullptr;
+}
+
+// 帯の圧縮にかかったCPU時間を返して0に戻す
+VskDwordLong VskPngWriter::take_helper_cpu_ns()
+{
+    VskDwordLong ns = m_band_cpu_ns;
+    m_band_cpu_ns = 0;
+    return ns;
+}
@@ -0,0 +1,80 @@
+// png.h --- PNGエンコーダー
+#pragma once
+
+#include "types.h"
+#include "image_writer.h"
+#include "deflate.h"
+#include "thread_pool.h"
+
+// PNGの出力形式
+enum VSK_PNG_FORMAT
+{
+    VSK_PNG_PALETTE1,   // 1ビット、2色のパレット（白、黒）
+    VSK_PNG_GRAY1,      // 1ビットのグレースケール
+};
+
+// CRC-32を計算する
+VskDword vsk_crc32(VskDword crc, const void *data, size_t size);
+
+// 並列に圧縮するときの帯の大きさの目安（フィルタ済みの行のバイト数）
+#define VSK_PNG_BAND_SIZE (256 * 1024)
+
+// 並列に圧縮する行の帯
+struct VskPngBand
+{
+    std::vector<VskByte> m_dict;    // 前の帯の末尾（辞書）
+    std::vector<VskByte> m_data;    // フィルタ済みの行
+    std::vector<VskByte> m_out;     // 圧縮データ
+    bool m_final = false;           // 最後の帯か？
+    bool m_done = false;            // 圧縮が終わったか？
+    VskDwordLong m_cpu_ns = 0;      // 圧縮にかかったCPU時間
+};
+
+// PNGエンコーダー。圧縮器と作業用バッファはページ間で再利用される。
+// m_poolがあれば、画像を行の帯に分けて同期フラッシュで区切りながら並列に圧縮し、
+// 1つのzlibストリームにつなげる（pigzと同じ方法）
+struct VskPngWriter : VskImageWriter
+{
+    VSK_PNG_FORMAT m_format = VSK_PNG_PALETTE1; // 出力形式
+    VskDeflater m_deflater;                     // 圧縮器
+    std::vector<VskByte> m_idat;                // 圧縮データ
+    std::vector<VskByte> m_row;                 // フィルタ種別と1行分のデータ
+    std::vector<VskByte> *m_out = nullptr;      // 出力先
+    VskDword m_adler = 1;                       // 非圧縮データのAdler-32
+    int m_width = 0;                            // 画像の幅
+    int m_height = 0;                           // 画像の高さ
+    int m_rows = 0;                             // 書き込んだ行数
+    bool m_row_blank = false;                   // m_rowが白い行のままか？
+    VskThreadPool *m_pool = nullptr;            // 帯を圧縮するスレッドプール（呼び出し元とは別のもの）
+    size_t m_band_size = VSK_PNG_BAND_SIZE;     // 帯の大きさの目安
+    std::vector<VskByte> m_band;                // 圧縮待ちの行
+    std::vector<VskByte> m_tail;                // これまでの行の末尾（次の帯の辞書）
+    std::vector<std::unique_ptr<VskPngBand> > m_bands;  // 圧縮中の帯（リングバッファ）
+    std::vector<VskDeflater> m_band_deflaters;  // プールのワーカーごとの圧縮器
+    size_t m_bands_submitted = 0;               // 圧縮を始めた帯の数
+    size_t m_bands_written = 0;                 // IDATに書き込んだ帯の数
+    VskDwordLong m_band_cpu_ns = 0;             // プールで帯の圧縮にかかったCPU時間の合計
+    std::mutex m_band_mutex;                    // m_bandsのm_doneを保護する
+    std::condition_variable m_band_cond;        // 帯の圧縮が終わった
+
+    // 圧縮レベルを設定する（0～9）
+    void set_level(int level);
+
+    // PNGの書き込みを開始する
+    void begin(int width, int height, std::vector<VskByte>& out) override;
+    // 1ビットの行を書き込む（MSBが左端、ビットが立っていれば黒）
+    void write_row(const VskByte *bits) override;
+    // 白い行を書き込む
+    void write_blank_row() override;
+    // PNGの書き込みを終了する
+    void end() override;
+    // 帯の圧縮にかかったCPU時間を返して0に戻す
+    VskDwordLong take_helper_cpu_ns() override;
+
+protected:
+    void write_chunk(const char *type, const VskByte *data, size_t size);
+    void flush_idat(bool all);
+    void put_row();
+    void submit_band(bool final);
+    void collect_band();
+};
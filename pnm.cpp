@@ -0,0 +1,90 @@
+// pnm.cpp --- PBM/PGMエンコーダー
+#include "pnm.h"
+#include <climits>
+#include <cstdio>
+
+namespace {
+
+// 1バイトの8ピクセルをPGMの8バイト（黒は0、白は255）に展開する表
+struct VskGrayTable
+{
+    VskByte m_table[256][CHAR_BIT];
+
+    VskGrayTable()
+    {
+        for (int value = 0; value < 256; ++value)
+        {
+            for (int bit = 0; bit < CHAR_BIT; ++bit)
+                m_table[value][bit] = (value & (0x80 >> bit)) ? 0 : 255;
+        }
+    }
+};
+
+const VskGrayTable& vsk_gray_table()
+{
+    static const VskGrayTable s_table;
+    return s_table;
+}
+
+} // namespace
+
+// 書き込みを開始する
+void VskPnmWriter::begin(int width, int height, std::vector<VskByte>& out)
+{
+    m_out = &out;
+    m_width = width;
+    m_height = height;
+    m_rows = 0;
+
+    char header[64];
+    int len;
+    if (m_gray)
+        len = std::snprintf(header, sizeof(header), "P5\n%d %d\n255\n", width, height);
+    else
+        len = std::snprintf(header, sizeof(header), "P4\n%d %d\n", width, height);
+    const size_t row_size = m_gray ? size_t(width) : size_t(width + CHAR_BIT - 1) / CHAR_BIT;
+    out.reserve(out.size() + len + row_size * height);
+    out.insert(out.end(), header, header + len);
+}
+
+// 1ビットの行を書き込む（MSBが左端、ビットが立っていれば黒）
+void VskPnmWriter::write_row(const VskByte *bits)
+{
+    assert(m_rows < m_height);
+    auto& out = *m_out;
+    const int full = m_width / CHAR_BIT, rest = m_width % CHAR_BIT;
+    if (m_gray)
+    {
+        const VskGrayTable& table = vsk_gray_table();
+        for (int i = 0; i < full; ++i)
+            out.insert(out.end(), table.m_table[bits[i]], table.m_table[bits[i]] + CHAR_BIT);
+        if (rest)
+            out.insert(out.end(), table.m_table[bits[full]], table.m_table[bits[full]] + rest);
+    }
+    else
+    {
+        out.insert(out.end(), bits, bits + full);
+        if (rest)
+            out.push_back(VskByte(bits[full] & (0xFF << (CHAR_BIT - rest)))); // 右端の余りのビットは0にする
+    }
+    ++m_rows;
+}
+
+// 白い行を書き込む
+void VskPnmWriter::write_blank_row()
+{
+    assert(m_rows < m_height);
+    auto& out = *m_out;
+    if (m_gray)
+        out.insert(out.end(), size_t(m_width), VskByte(255));
+    else
+        out.insert(out.end(), size_t(m_width + CHAR_BIT - 1) / CHAR_BIT, VskByte(0));
+    ++m_rows;
+}
+
+// 書き込みを終了する
+void VskPnmWriter::end()
+{
+    assert(m_rows == m_height);
+    m_out = nullptr;
+}
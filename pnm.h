@@ -0,0 +1,23 @@
+// pnm.h --- PBM/PGMエンコーダー
+#pragma once
+
+#include "image_writer.h"
+
+// PBM（P4）かPGM（P5）のエンコーダー。圧縮しないので、PBMは1ビットの行をそのまま書き込むだけ
+struct VskPnmWriter : VskImageWriter
+{
+    bool m_gray = false;                        // PGMで出力するか？
+    std::vector<VskByte> *m_out = nullptr;      // 出力先
+    int m_width = 0;                            // 画像の幅
+    int m_height = 0;                           // 画像の高さ
+    int m_rows = 0;                             // 書き込んだ行数
+
+    // 書き込みを開始する
+    void begin(int width, int height, std::vector<VskByte>& out) override;
+    // 1ビットの行を書き込む（MSBが左端、ビットが立っていれば黒）
+    void write_row(const VskByte *bits) override;
+    // 白い行を書き込む
+    void write_blank_row() override;
+    // 書き込みを終了する
+    void end() override;
+};
@@ -0,0 +1,171 @@
+// session.cpp --- 編集に合わせて描画し直すセッション
+#include "session.h"
+#include <algorithm>
+
+VskRenderSession::VskRenderSession(const VskTextToPng& settings)
+    : m_text2png(settings)
+{
+    m_text2png.m_text = std::string_view();
+    m_text2png.m_hbm = nullptr;
+    m_text2png.m_page_starts.clear();
+}
+
+VskRenderSession::~VskRenderSession()
+{
+    for (auto image : m_pages)
+        vsk_destroy_image(image);
+}
+
+// page番目（1から）のページのテキスト
+std::string_view VskRenderSession::page_text(int page) const
+{
+    if (page <= 0 || page > page_count())
+        return std::string_view();
+    size_t start = m_page_offsets[page - 1];
+    size_t end = (page < page_count()) ? m_page_offsets[page] : m_buffer.size();
+    return std::string_view(m_buffer).substr(start, end - start);
+}
+
+// index番目（0から）のページにtextを描画する。文字の行がfirst_rowより上の部分は描き直さない
+bool VskRenderSession::render(int index, std::string_view text, int first_row)
+{
+    int cx, cy;
+    vsk_get_page_size(m_text2png, cx, cy);
+    VskImageHandle& image = m_pages[index];
+    const int bpp = m_text2png.m_bpp;
+    if (!image || image->m_width != cx || image->m_height != cy || image->m_bpp != bpp)
+    {
+        vsk_destroy_image(image);
+        image = vsk_create_image(cx, cy, bpp);
+        if (!image)
+            return false;
+        first_row = 0;
+    }
+    return vsk_render_page_text_rows(m_text2png, text, first_row, VskPixelBuffer(*image), &m_cache);
+}
+
+// テキストを置き換えてすべてのページを描画する
+bool VskRenderSession::set_text(std::string_view text)
+{
+    m_buffer.assign(text.data(), text.size());
+    m_text2png.m_text = m_buffer;
+    m_dirty_pages.clear();
+
+    // 空のテキストでも白紙を1ページ描画する
+    VskPaginator paginator(m_text2png.m_max_x, m_text2png.m_max_y);
+    std::string_view rest = m_buffer;
+    size_t offset = 0, used;
+    bool ok = true;
+    int index = 0;
+    for (;; ++index)
+    {
+        bool page_break = paginator.feed(rest.substr(offset), used);
+        if (index >= page_count())
+        {
+            m_page_offsets.push_back(0);
+            m_pages.push_back(nullptr);
+        }
+        m_page_offsets[index] = offset;
+        ok = render(index, rest.substr(offset, used), 0) && ok;
+        m_dirty_pages.push_back(index + 1);
+        offset += used;
+        if (!page_break)
+            break;
+    }
+
+    for (int i = index + 1; i < page_count(); ++i)
+        vsk_destroy_image(m_pages[i]);
+    m_page_offsets.resize(index + 1);
+    m_pages.resize(index + 1);
+    return ok;
+}
+
+// offsetからlengthバイトをreplacementで置き換え、影響を受けたページだけを描画し直す
+bool VskRenderSession::edit(size_t offset, size_t length, std::string_view replacement)
+{
+    if (offset > m_buffer.size())
+        return false;
+    length = std::min(length, m_buffer.size() - offset);
+
+    if (m_pages.empty())
+    {
+        std::string text = m_buffer;
+        text.replace(offset, length, replacement.data(), replacement.size());
+        return set_text(text);
+    }
+
+    // 編集位置を含むページと、そのページでの編集位置の行。それより上の行は変わらない
+    size_t index = std::upper_bound(m_page_offsets.begin(), m_page_offsets.end(), offset) -
+                   m_page_offsets.begin() - 1;
+    VskPaginator paginator(m_text2png.m_max_x, m_text2png.m_max_y);
+    size_t used;
+    size_t pos = m_page_offsets[index];
+    paginator.feed(std::string_view(m_buffer).substr(pos, offset - pos), used);
+    int first_row = paginator.m_y;
+
+    m_buffer.replace(offset, length, replacement.data(), replacement.size());
+    m_text2png.m_text = m_buffer;
+    std::string_view text = m_buffer;
+    const size_t edit_end = offset + replacement.size();
+
+    // 編集位置より後ろのページの元の開始位置とイメージ
+    std::vector<size_t> old_offsets(m_page_offsets.begin() + index + 1, m_page_offsets.end());
+    std::vector<VskImageHandle> old_pages(m_pages.begin() + index + 1, m_pages.end());
+    m_page_offsets.resize(index + 1);
+    m_pages.resize(index + 1);
+    std::vector<VskImageHandle> spares; // 不要になったイメージ（新しいページに使い回す）
+    size_t next_old = 0;
+    bool resynced = false, ok = true;
+
+    m_dirty_pages.clear();
+    for (;;)
+    {
+        paginator.reset();
+        bool page_break = paginator.feed(text.substr(pos), used);
+        ok = render(int(index), text.substr(pos, used), first_row) && ok;
+        m_dirty_pages.push_back(int(index) + 1);
+        first_row = 0;
+        pos += used;
+        if (!page_break)
+            break;
+
+        // 編集した範囲を過ぎて元のページの開始位置と一致したら、残りのページはずらすだけ
+        if (pos >= edit_end)
+        {
+            size_t old_pos = pos - replacement.size() + length;
+            for (; next_old < old_offsets.size() && old_offsets[next_old] < old_pos; ++next_old)
+                spares.push_back(old_pages[next_old]);
+            if (next_old < old_offsets.size() && old_offsets[next_old] == old_pos)
+            {
+                for (; next_old < old_offsets.size(); ++next_old)
+                {
+                    m_page_offsets.push_back(old_offsets[next_old] - length + replacement.size());
+                    m_pages.push_back(old_pages[next_old]);
+                }
+                resynced = true;
+                break;
+            }
+        }
+
+        m_page_offsets.push_back(pos);
+        if (!spares.empty())
+        {
+            m_pages.push_back(spares.back());
+            spares.pop_back();
+        }
+        else
+        {
+            m_pages.push_back(nullptr);
+        }
+        ++index;
+    }
+
+    if (!resynced)
+    {
+        for (; next_old < old_offsets.size(); ++next_old)
+            spares.push_back(old_pages[next_old]);
+    }
+    for (auto image : spares)
+        vsk_destroy_image(image);
+    return ok;
+}
@@ -0,0 +1,46 @@
+// session.h --- 編集に合わせて描画し直すセッション
+#pragma once
+
+#include "txt2png.h"
+#include "glyph_cache.h"
+
+// テキストのページ割りと描画したページを保持し、編集されたら影響を受けた部分だけを描画し直す。
+// ページはかならず改行の直後で始まるので、編集位置より後ろでページの開始位置が
+// 元のページ割りと一致したら、そこから先のページは描き直さずにずらすだけでよい
+struct VskRenderSession
+{
+    VskTextToPng m_text2png;                // 描画の設定（m_textはm_bufferを指す）
+    std::string m_buffer;                   // テキスト
+    std::vector<size_t> m_page_offsets;     // 各ページの開始位置
+    std::vector<VskImageHandle> m_pages;    // 描画したページ
+    std::vector<int> m_dirty_pages;         // 直前の更新で描画し直したページ番号（1から）
+    VskGlyphCache m_cache;
+
+    explicit VskRenderSession(const VskTextToPng& settings);
+    ~VskRenderSession();
+    VskRenderSession(const VskRenderSession&) = delete;
+    VskRenderSession& operator=(const VskRenderSession&) = delete;
+
+    // テキストを置き換えてすべてのページを描画する。m_text2pngの設定を変えたときも呼ぶこと
+    bool set_text(std::string_view text);
+    // offsetからlengthバイトをreplacementで置き換え、影響を受けたページだけを描画し直す
+    bool edit(size_t offset, size_t length, std::string_view replacement);
+
+    // ページ数
+    int page_count() const
+    {
+        return int(m_pages.size());
+    }
+    // page番目（1から）のページ。なければnullptr
+    const VskFrameBuffer *page(int page) const
+    {
+        if (page <= 0 || page > page_count())
+            return nullptr;
+        return m_pages[page - 1];
+    }
+    // page番目（1から）のページのテキスト
+    std::string_view page_text(int page) const;
+
+protected:
+    bool render(int index, std::string_view text, int first_row);
+};
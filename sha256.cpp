@@ -0,0 +1,129 @@
+// sha256.cpp --- SHA-256 (FIPS 180-4)
+#include "sha256.h"
+#include <algorithm>
+
+static const VskDword s_k[64] =
+{
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+static inline VskDword vsk_rotr(VskDword x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+// 計算を最初からやり直す
+void VskSha256::reset()
+{
+    static const VskDword s_init[8] =
+    {
+        0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+    };
+    std::memcpy(m_state, s_init, sizeof(m_state));
+    m_block_len = 0;
+    m_total = 0;
+}
+
+// 64バイトのブロックを処理する
+void VskSha256::transform(const VskByte *block)
+{
+    VskDword w[64];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = (VskDword(block[4*i]) << 24) | (VskDword(block[4*i + 1]) << 16) |
+               (VskDword(block[4*i + 2]) << 8) | VskDword(block[4*i + 3]);
+    }
+    for (int i = 16; i < 64; ++i)
+    {
+        VskDword s0 = vsk_rotr(w[i - 15], 7) ^ vsk_rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        VskDword s1 = vsk_rotr(w[i - 2], 17) ^ vsk_rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    VskDword a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+    VskDword e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+    for (int i = 0; i < 64; ++i)
+    {
+        VskDword s1 = vsk_rotr(e, 6) ^ vsk_rotr(e, 11) ^ vsk_rotr(e, 25);
+        VskDword ch = (e & f) ^ (~e & g);
+        VskDword t1 = h + s1 + ch + s_k[i] + w[i];
+        VskDword s0 = vsk_rotr(a, 2) ^ vsk_rotr(a, 13) ^ vsk_rotr(a, 22);
+        VskDword maj = (a & b) ^ (a & c) ^ (b & c);
+        VskDword t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    m_state[0] += a; m_state[1] += b; m_state[2] += c; m_state[3] += d;
+    m_state[4] += e; m_state[5] += f; m_state[6] += g; m_state[7] += h;
+}
+
+// データを追加する
+void VskSha256::update(const void *data, size_t size)
+{
+    auto bytes = static_cast<const VskByte *>(data);
+    m_total += size;
+    if (m_block_len)
+    {
+        size_t len = std::min(size, sizeof(m_block) - m_block_len);
+        std::memcpy(m_block + m_block_len, bytes, len);
+        m_block_len += len;
+        bytes += len;
+        size -= len;
+        if (m_block_len < sizeof(m_block))
+            return;
+        transform(m_block);
+        m_block_len = 0;
+    }
+    for (; size >= sizeof(m_block); bytes += sizeof(m_block), size -= sizeof(m_block))
+        transform(bytes);
+    std::memcpy(m_block, bytes, size);
+    m_block_len = size;
+}
+
+// ハッシュ値（32バイト）をdigestに格納する
+void VskSha256::finish(VskByte digest[32])
+{
+    // 0x80と0を詰め、最後の8バイトに入力のビット数を置く
+    VskDwordLong bits = m_total * 8;
+    VskByte pad[72] = { 0x80 };
+    size_t pad_len = ((m_block_len < 56) ? 56 : 120) - m_block_len;
+    for (int i = 0; i < 8; ++i)
+        pad[pad_len + i] = VskByte(bits >> (56 - 8*i));
+    update(pad, pad_len + 8);
+    assert(m_block_len == 0);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        digest[4*i] = VskByte(m_state[i] >> 24);
+        digest[4*i + 1] = VskByte(m_state[i] >> 16);
+        digest[4*i + 2] = VskByte(m_state[i] >> 8);
+        digest[4*i + 3] = VskByte(m_state[i]);
+    }
+}
+
+// ハッシュ値を小文字の16進数の文字列にする
+std::string vsk_hex_digest(const VskByte digest[32])
+{
+    static const char s_hex[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(64);
+    for (int i = 0; i < 32; ++i)
+    {
+        hex += s_hex[digest[i] >> 4];
+        hex += s_hex[digest[i] & 0xF];
+    }
+    return hex;
+}
@@ -0,0 +1,28 @@
+// sha256.h --- SHA-256 (FIPS 180-4)
+#pragma once
+
+#include "types.h"
+
+// SHA-256のハッシュ計算
+struct VskSha256
+{
+    VskDword m_state[8];            // ハッシュ値
+    VskByte m_block[64];            // 処理待ちのブロック
+    size_t m_block_len = 0;         // m_blockのバイト数
+    VskDwordLong m_total = 0;       // 入力の総バイト数
+
+    VskSha256() { reset(); }
+
+    // 計算を最初からやり直す
+    void reset();
+    // データを追加する
+    void update(const void *data, size_t size);
+    // ハッシュ値（32バイト）をdigestに格納する。そのあとはresetするまで使えない
+    void finish(VskByte digest[32]);
+
+protected:
+    void transform(const VskByte *block);
+};
+
+// ハッシュ値を小文字の16進数の文字列にする
+std::string vsk_hex_digest(const VskByte digest[32]);
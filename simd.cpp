@@ -0,0 +1,299 @@
+// simd.cpp --- グリフの行を展開し、テキストを走査するSIMDカーネル
+#include "simd.h"
+#include "framebuffer.h"
+#include "encoding.h"
+#include <cstdlib>
+
+// SSE2を前提にできるビルド（x86-64か、-msse2などを付けた32ビットのx86）だけSIMDカーネルを使う。
+// 32ビットでSSE2を前提にしないビルドはSSE2のないCPUでも動くようにスカラー版だけにする
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define VSK_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define VSK_TARGET_AVX2
+    #else
+        #define VSK_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////////////////
+// スカラー版
+
+void vsk_draw_bits_32_scalar(VskDword *dest, VskDword bits, int count)
+{
+    for (int i = 0; i < count; ++i, bits <<= 1)
+    {
+        if (bits & 0x80000000)
+            dest[i] = VSK_COLOR_BLACK;
+    }
+}
+
+void vsk_draw_bits_8_scalar(VskByte *dest, VskDword bits, int count)
+{
+    for (int i = 0; i < count; ++i, bits <<= 1)
+    {
+        if (bits & 0x80000000)
+            dest[i] = 1;
+    }
+}
+
+// 改行かSJISリードバイトなら1になる表
+struct VskStopBytes
+{
+    VskByte m_stop[256];
+    VskStopBytes()
+    {
+        for (int i = 0; i < 256; ++i)
+            m_stop[i] = (i == '\r' || i == '\n' || vsk_is_sjis_lead(VskByte(i)));
+    }
+};
+const VskStopBytes s_stop_bytes;
+
+VskDwordLong vsk_scan_text_scalar(const VskByte *data, size_t size)
+{
+    VskDwordLong mask = 0;
+    for (size_t i = 0; i < size; ++i)
+        mask |= VskDwordLong(s_stop_bytes.m_stop[data[i]]) << i;
+    return mask;
+}
+
+const VskPixelKernels s_scalar_kernels =
+{
+    "scalar",
+    vsk_draw_bits_32_scalar,
+    vsk_draw_bits_8_scalar,
+    vsk_scan_text_scalar,
+};
+
+#ifdef VSK_X86
+
+////////////////////////////////////////////////////////////////////////////////////
+// SSE2版
+
+const VskDwordLong VSK_REPEAT8 = 0x0101010101010101ULL;
+
+// 16バイトの各レーンで調べるビット（左端がMSB）
+inline __m128i vsk_byte_selectors_sse2()
+{
+    return _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, char(128), 1, 2, 4, 8, 16, 32, 64, char(128));
+}
+
+void vsk_draw_bits_32_sse2(VskDword *dest, VskDword bits, int count)
+{
+    const __m128i sel = _mm_set_epi32(0x10000000, 0x20000000, 0x40000000, int(0x80000000));
+    const __m128i black = _mm_set1_epi32(int(VSK_COLOR_BLACK));
+    __m128i vbits = _mm_set1_epi32(int(bits));
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(vbits, sel), sel);
+        __m128i *p = reinterpret_cast<__m128i *>(dest + i);
+        __m128i d = _mm_loadu_si128(p);
+        d = _mm_or_si128(_mm_andnot_si128(mask, d), _mm_and_si128(mask, black));
+        _mm_storeu_si128(p, d);
+        vbits = _mm_slli_epi32(vbits, 4);
+    }
+    vsk_draw_bits_32_scalar(dest + i, (i < 32) ? (bits << i) : 0, count - i);
+}
+
+void vsk_draw_bits_8_sse2(VskByte *dest, VskDword bits, int count)
+{
+    const __m128i sel = vsk_byte_selectors_sse2();
+    const __m128i one = _mm_set1_epi8(1);
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        VskDword b = bits << i;
+        __m128i v = _mm_set_epi64x(VskLongLong(((b >> 16) & 0xFF) * VSK_REPEAT8),
+                                   VskLongLong((b >> 24) * VSK_REPEAT8));
+        __m128i mask = _mm_cmpeq_epi8(_mm_and_si128(v, sel), sel);
+        __m128i *p = reinterpret_cast<__m128i *>(dest + i);
+        __m128i d = _mm_loadu_si128(p);
+        d = _mm_or_si128(_mm_andnot_si128(mask, d), _mm_and_si128(mask, one));
+        _mm_storeu_si128(p, d);
+    }
+    if (i + 8 <= count)
+    {
+        // 8ピクセルだけなら下位の64ビットを使う
+        VskDword b = (i < 32) ? (bits << i) : 0;
+        __m128i v = _mm_set_epi64x(0, VskLongLong((b >> 24) * VSK_REPEAT8));
+        __m128i mask = _mm_cmpeq_epi8(_mm_and_si128(v, sel), sel);
+        __m128i *p = reinterpret_cast<__m128i *>(dest + i);
+        __m128i d = _mm_loadl_epi64(p);
+        d = _mm_or_si128(_mm_andnot_si128(mask, d), _mm_and_si128(mask, one));
+        _mm_storel_epi64(p, d);
+        i += 8;
+    }
+    vsk_draw_bits_8_scalar(dest + i, (i < 32) ? (bits << i) : 0, count - i);
+}
+
+// 16バイトのうち改行かSJISリードバイト（0x81～0x9F、0xE0～0xEF）のレーンが0xFFになる。
+// 範囲の判定は、下限を引いたものが幅以下か（符号なしの最小値で比べる）で行う
+inline __m128i vsk_stop_bytes_sse2(__m128i v)
+{
+    const __m128i lead1 = _mm_sub_epi8(v, _mm_set1_epi8(char(0x81)));
+    const __m128i lead2 = _mm_sub_epi8(v, _mm_set1_epi8(char(0xE0)));
+    const __m128i width1 = _mm_set1_epi8(0x9F - 0x81), width2 = _mm_set1_epi8(0xEF - 0xE0);
+    __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    stop = _mm_or_si128(stop, _mm_cmpeq_epi8(_mm_min_epu8(lead1, width1), lead1));
+    return _mm_or_si128(stop, _mm_cmpeq_epi8(_mm_min_epu8(lead2, width2), lead2));
+}
+
+VskDwordLong vsk_scan_text_sse2(const VskByte *data, size_t size)
+{
+    if (size < 64)
+        return vsk_scan_text_scalar(data, size);
+    VskDwordLong mask = 0;
+    for (int i = 0; i < 64; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        mask |= VskDwordLong(VskDword(_mm_movemask_epi8(vsk_stop_bytes_sse2(v)))) << i;
+    }
+    return mask;
+}
+
+const VskPixelKernels s_sse2_kernels =
+{
+    "sse2",
+    vsk_draw_bits_32_sse2,
+    vsk_draw_bits_8_sse2,
+    vsk_scan_text_sse2,
+};
+
+////////////////////////////////////////////////////////////////////////////////////
+// AVX2版
+
+VSK_TARGET_AVX2
+void vsk_draw_bits_32_avx2(VskDword *dest, VskDword bits, int count)
+{
+    const __m256i sel = _mm256_set_epi32(0x01000000, 0x02000000, 0x04000000, 0x08000000,
+                                         0x10000000, 0x20000000, 0x40000000, int(0x80000000));
+    const __m256i black = _mm256_set1_epi32(int(VSK_COLOR_BLACK));
+    __m256i vbits = _mm256_set1_epi32(int(bits));
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(vbits, sel), sel);
+        __m256i *p = reinterpret_cast<__m256i *>(dest + i);
+        __m256i d = _mm256_loadu_si256(p);
+        _mm256_storeu_si256(p, _mm256_blendv_epi8(d, black, mask));
+        vbits = _mm256_slli_epi32(vbits, 8);
+    }
+    vsk_draw_bits_32_sse2(dest + i, (i < 32) ? (bits << i) : 0, count - i);
+}
+
+VSK_TARGET_AVX2
+void vsk_draw_bits_8_avx2(VskByte *dest, VskDword bits, int count)
+{
+    if (count < 32)
+    {
+        vsk_draw_bits_8_sse2(dest, bits, count);
+        return;
+    }
+    const __m256i sel = _mm256_set_epi8(1, 2, 4, 8, 16, 32, 64, char(128), 1, 2, 4, 8, 16, 32, 64, char(128),
+                                        1, 2, 4, 8, 16, 32, 64, char(128), 1, 2, 4, 8, 16, 32, 64, char(128));
+    __m256i v = _mm256_set_epi64x(VskLongLong((bits & 0xFF) * VSK_REPEAT8),
+                                  VskLongLong(((bits >> 8) & 0xFF) * VSK_REPEAT8),
+                                  VskLongLong(((bits >> 16) & 0xFF) * VSK_REPEAT8),
+                                  VskLongLong((bits >> 24) * VSK_REPEAT8));
+    __m256i mask = _mm256_cmpeq_epi8(_mm256_and_si256(v, sel), sel);
+    __m256i *p = reinterpret_cast<__m256i *>(dest);
+    _mm256_storeu_si256(p, _mm256_blendv_epi8(_mm256_loadu_si256(p), _mm256_set1_epi8(1), mask));
+}
+
+// 32バイトのうち改行かSJISリードバイトの位置のビットを立てる
+VSK_TARGET_AVX2
+inline VskDword vsk_stop_mask_avx2(const VskByte *data)
+{
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    __m256i lead1 = _mm256_sub_epi8(v, _mm256_set1_epi8(char(0x81)));
+    __m256i lead2 = _mm256_sub_epi8(v, _mm256_set1_epi8(char(0xE0)));
+    const __m256i width1 = _mm256_set1_epi8(0x9F - 0x81), width2 = _mm256_set1_epi8(0xEF - 0xE0);
+    __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+                                   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(_mm256_min_epu8(lead1, width1), lead1));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(_mm256_min_epu8(lead2, width2), lead2));
+    return VskDword(_mm256_movemask_epi8(stop));
+}
+
+VSK_TARGET_AVX2
+VskDwordLong vsk_scan_text_avx2(const VskByte *data, size_t size)
+{
+    if (size < 64)
+        return vsk_scan_text_scalar(data, size);
+    return vsk_stop_mask_avx2(data) | (VskDwordLong(vsk_stop_mask_avx2(data + 32)) << 32);
+}
+
+const VskPixelKernels s_avx2_kernels =
+{
+    "avx2",
+    vsk_draw_bits_32_avx2,
+    vsk_draw_bits_8_avx2,
+    vsk_scan_text_avx2,
+};
+
+// CPUがAVX2に対応しているか？
+bool vsk_cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif  // def VSK_X86
+
+// 最適なカーネルを選ぶ
+const VskPixelKernels& vsk_select_pixel_kernels()
+{
+    if (const char *name = getenv("TXT2PNG_SIMD"))
+    {
+        if (const VskPixelKernels *kernels = vsk_find_pixel_kernels(name))
+            return *kernels;
+    }
+#ifdef VSK_X86
+    if (vsk_cpu_has_avx2())
+        return s_avx2_kernels;
+    return s_sse2_kernels; // SSE2はビルドの前提にある
+#else
+    return s_scalar_kernels;
+#endif
+}
+
+} // namespace
+
+// 名前で指定したカーネルを返す。CPUが対応していなければnullptrを返す
+const VskPixelKernels *vsk_find_pixel_kernels(const char *name)
+{
+    std::string str = name;
+    if (str == "scalar")
+        return &s_scalar_kernels;
+#ifdef VSK_X86
+    if (str == "sse2")
+        return &s_sse2_kernels;
+    if (str == "avx2" && vsk_cpu_has_avx2())
+        return &s_avx2_kernels;
+#endif
+    return nullptr;
+}
+
+// CPUに合ったカーネルを返す
+const VskPixelKernels& vsk_pixel_kernels()
+{
+    static const VskPixelKernels& s_kernels = vsk_select_pixel_kernels();
+    return s_kernels;
+}
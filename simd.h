@@ -0,0 +1,41 @@
+// simd.h --- グリフの行を展開し、テキストを走査するSIMDカーネル
+#pragma once
+
+#include "types.h"
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+// インクのビット列（ビット31が左端）の立っている所を黒にする（32BPP）
+typedef void (*VskDrawBits32Proc)(VskDword *dest, VskDword bits, int count);
+// インクのビット列（ビット31が左端）の立っている所を黒（インデックス1）にする（8BPP）
+typedef void (*VskDrawBits8Proc)(VskByte *dest, VskDword bits, int count);
+// dataの先頭sizeバイト（64以下）のうち、改行（\r、\n）かSJISリードバイトの位置のビットを立てる
+typedef VskDwordLong (*VskScanTextProc)(const VskByte *data, size_t size);
+
+// カーネルの組み合わせ。どの実装でも結果はビット単位で同じ
+struct VskPixelKernels
+{
+    const char *m_name;
+    VskDrawBits32Proc m_draw_bits_32;
+    VskDrawBits8Proc m_draw_bits_8;
+    VskScanTextProc m_scan_text;
+};
+
+// CPUに合ったカーネルを返す。環境変数TXT2PNG_SIMDにscalar、sse2、avx2を指定すると強制できる
+const VskPixelKernels& vsk_pixel_kernels();
+// 名前で指定したカーネルを返す。CPUが対応していなければnullptrを返す
+const VskPixelKernels *vsk_find_pixel_kernels(const char *name);
+
+// ビットの立っている最下位の位置（maskは0以外）
+inline int vsk_lowest_bit64(VskDwordLong mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return int(index);
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
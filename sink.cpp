@@ -0,0 +1,130 @@
+// sink.cpp --- 変換したページの出力先
+#include "sink.h"
+#include <ctime>
+#include <filesystem>
+#ifdef _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+#endif
+
+// tarのブロックサイズ
+#define VSK_TAR_BLOCK 512
+
+// ページごとにファイルを作る
+bool VskFileSink::write_page(int page, const char *name, const std::vector<VskByte>& data)
+{
+    // 前回の出力がキャッシュへのハードリンクかもしれないので、上書きせずに作り直す
+    std::remove(name);
+    FILE *fout = fopen(name, "wb");
+    if (!fout)
+        return false;
+    bool ok = data.empty() || (fwrite(data.data(), data.size(), 1, fout) == 1);
+    ok = (fclose(fout) == 0) && ok;
+    return ok;
+}
+
+// 既存のファイルをハードリンクし、できなければコピーする
+bool VskFileSink::link_page(int page, const char *name, const std::string& path)
+{
+    std::error_code ec;
+    std::filesystem::remove(name, ec);
+    std::filesystem::create_hard_link(path, name, ec);
+    if (!ec)
+        return true;
+    return std::filesystem::copy_file(path, name, std::filesystem::copy_options::overwrite_existing, ec);
+}
+
+// デストラクタ
+VskStreamSink::~VskStreamSink()
+{
+    if (m_owns_fp && m_fp)
+        fclose(m_fp);
+}
+
+// 出力先を開く。"-"なら標準出力
+bool VskStreamSink::open(const char *filename)
+{
+    if (std::strcmp(filename, "-") == 0)
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        m_fp = stdout;
+        m_owns_fp = false;
+        return true;
+    }
+    m_fp = fopen(filename, "wb");
+    m_owns_fp = true;
+    return m_fp != nullptr;
+}
+
+// データを書き込む
+bool VskStreamSink::write(const void *data, size_t size)
+{
+    return !size || fwrite(data, size, 1, m_fp) == 1;
+}
+
+// PNGをそのまま連結する
+bool VskStreamSink::write_page(int page, const char *name, const std::vector<VskByte>& data)
+{
+    // 次の段がすぐに読めるよう、ページごとにフラッシュする
+    return write(data.data(), data.size()) && fflush(m_fp) == 0;
+}
+
+// 出力を終える
+bool VskStreamSink::finish()
+{
+    bool ok = (fflush(m_fp) == 0) && !ferror(m_fp);
+    if (m_owns_fp)
+    {
+        ok = (fclose(m_fp) == 0) && ok;
+        m_fp = nullptr;
+    }
+    return ok;
+}
+
+// コンストラクタ
+VskTarSink::VskTarSink()
+{
+    m_mtime = VskDwordLong(time(nullptr));
+}
+
+// ページをtarのエントリーとして書き込む
+bool VskTarSink::write_page(int page, const char *name, const std::vector<VskByte>& data)
+{
+    if (std::strlen(name) >= 100)
+        return false;
+
+    // ustarのヘッダー
+    char header[VSK_TAR_BLOCK] = { 0 };
+    std::strcpy(header, name);                                          // name
+    std::strcpy(header + 100, "0000644");                               // mode
+    std::strcpy(header + 108, "0000000");                               // uid
+    std::strcpy(header + 116, "0000000");                               // gid
+    std::snprintf(header + 124, 12, "%011llo", (unsigned long long)data.size());   // size
+    std::snprintf(header + 136, 12, "%011llo", (unsigned long long)m_mtime);       // mtime
+    std::memset(header + 148, ' ', 8);                                  // chksum（計算中は空白）
+    header[156] = '0';                                                  // typeflag
+    std::memcpy(header + 257, "ustar", 6);                              // magic
+    std::memcpy(header + 263, "00", 2);                                 // version
+
+    unsigned sum = 0;
+    for (char ch : header)
+        sum += VskByte(ch);
+    std::snprintf(header + 148, 8, "%06o", sum);
+    header[155] = ' ';
+
+    // データはブロック境界までゼロで埋める
+    static const char padding[VSK_TAR_BLOCK] = { 0 };
+    size_t pad = (VSK_TAR_BLOCK - data.size() % VSK_TAR_BLOCK) % VSK_TAR_BLOCK;
+    return write(header, sizeof(header)) && write(data.data(), data.size()) &&
+           write(padding, pad) && fflush(m_fp) == 0;
+}
+
+// 終わりの印として空のブロックを2つ書き込む
+bool VskTarSink::finish()
+{
+    static const char padding[2 * VSK_TAR_BLOCK] = { 0 };
+    bool ok = write(padding, sizeof(padding));
+    return VskStreamSink::finish() && ok;
+}
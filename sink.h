@@ -0,0 +1,57 @@
+// sink.h --- 変換したページの出力先
+#pragma once
+
+#include "types.h"
+#include <cstdio>
+
+// ページの出力先。ページはページ番号順に渡される
+struct VskPageSink
+{
+    virtual ~VskPageSink() { }
+
+    // ページを出力する。nameはページのファイル名
+    virtual bool write_page(int page, const char *name, const std::vector<VskByte>& data) = 0;
+    // 既存のファイルをページとして出力できるか？
+    virtual bool can_link() const { return false; }
+    // 既存のファイルpathをページとして出力する（ハードリンクかコピー）
+    virtual bool link_page(int page, const char *name, const std::string& path) { return false; }
+    // 出力を終える
+    virtual bool finish() { return true; }
+};
+
+// ページごとにファイルを作る
+struct VskFileSink : VskPageSink
+{
+    bool write_page(int page, const char *name, const std::vector<VskByte>& data) override;
+    bool can_link() const override { return true; }
+    bool link_page(int page, const char *name, const std::string& path) override;
+};
+
+// 全ページをひとつのストリームに連結して書き出す
+struct VskStreamSink : VskPageSink
+{
+    FILE *m_fp = nullptr;           // 出力先
+    bool m_owns_fp = false;         // m_fpを閉じるか？
+
+    ~VskStreamSink() override;
+
+    // 出力先を開く。"-"なら標準出力
+    bool open(const char *filename);
+
+    bool write_page(int page, const char *name, const std::vector<VskByte>& data) override;
+    bool finish() override;
+
+protected:
+    bool write(const void *data, size_t size);
+};
+
+// 全ページをtarアーカイブ（ustar形式）にして書き出す
+struct VskTarSink : VskStreamSink
+{
+    VskDwordLong m_mtime = 0;       // エントリーの更新時刻
+
+    VskTarSink();
+
+    bool write_page(int page, const char *name, const std::vector<VskByte>& data) override;
+    bool finish() override;
+};
@@ -0,0 +1,264 @@
+// stats.cpp --- 変換の統計（--stats）
+#include "stats.h"
+#include <chrono>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <time.h>
+    #include <sys/resource.h>
+#endif
+
+static const char *s_stage_names[VSK_STAGE_COUNT] =
+{
+    "read", "paginate", "raster", "encode", "write"
+};
+
+// 現在時刻（ナノ秒）
+VskDwordLong vsk_now_ns()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return VskDwordLong(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+
+#ifdef _WIN32
+// FILETIMEの組の合計（100ナノ秒単位）をナノ秒にする
+static VskDwordLong vsk_filetime_ns(const FILETIME& kernel, const FILETIME& user)
+{
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) * 100;
+}
+#endif
+
+// 現在のスレッドのCPU時間（ナノ秒）
+VskDwordLong vsk_thread_cpu_ns()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+    return vsk_filetime_ns(kernel, user);
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return VskDwordLong(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// プロセスのCPU時間（ナノ秒）
+VskDwordLong vsk_process_cpu_ns()
+{
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+        return 0;
+    return vsk_filetime_ns(kernel, user);
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return VskDwordLong(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// プロセスの最大常駐メモリー（バイト数）
+VskDwordLong vsk_peak_rss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    #ifdef __APPLE__
+        return VskDwordLong(usage.ru_maxrss); // macOSはバイト単位
+    #else
+        return VskDwordLong(usage.ru_maxrss) * 1024; // Linuxはキロバイト単位
+    #endif
+#endif
+}
+
+// 全体の計測を開始する
+void VskStats::begin()
+{
+    m_start_ns = vsk_now_ns();
+    m_start_cpu_ns = vsk_process_cpu_ns();
+}
+
+// 全体の計測を終了する
+void VskStats::end()
+{
+    m_wall_ns = vsk_now_ns() - m_start_ns;
+    m_cpu_ns = vsk_process_cpu_ns() - m_start_cpu_ns;
+}
+
+// ナノ秒を秒にする
+static double vsk_seconds(VskDwordLong ns)
+{
+    return double(ns) / 1e9;
+}
+
+// 正しいUTF-8か？
+static bool vsk_is_utf8(const std::string& str)
+{
+    for (size_t i = 0; i < str.size(); )
+    {
+        const unsigned char ch = str[i];
+        int len = (ch < 0x80) ? 1 : (ch >= 0xC2 && ch < 0xE0) ? 2 : (ch >= 0xE0 && ch < 0xF0) ? 3 :
+                  (ch >= 0xF0 && ch < 0xF5) ? 4 : 0;
+        if (!len || i + len > str.size())
+            return false;
+        // 冗長な符号化、サロゲート、U+10FFFFより大きい値は受け付けない
+        const unsigned char next = (len > 1) ? str[i + 1] : 0x80;
+        if ((ch == 0xE0 && next < 0xA0) || (ch == 0xED && next >= 0xA0) ||
+            (ch == 0xF0 && next < 0x90) || (ch == 0xF4 && next >= 0x90))
+        {
+            return false;
+        }
+        for (int k = 1; k < len; ++k)
+        {
+            if ((str[i + k] & 0xC0) != 0x80)
+                return false;
+        }
+        i += len;
+    }
+    return true;
+}
+
+// JSONの文字列として出力する。UTF-8でない名前（シフトJISのファイル名など）は
+// 0x80以上のバイトを\u00XXにして、JSONとして読めるようにする
+static void vsk_print_json_string(FILE *fp, const std::string& str)
+{
+    const bool utf8 = vsk_is_utf8(str);
+    fputc('"', fp);
+    for (unsigned char ch : str)
+    {
+        switch (ch)
+        {
+        case '"': fputs("\\\"", fp); break;
+        case '\\': fputs("\\\\", fp); break;
+        case '\n': fputs("\\n", fp); break;
+        case '\r': fputs("\\r", fp); break;
+        case '\t': fputs("\\t", fp); break;
+        default:
+            if (ch < 0x20 || (ch >= 0x80 && !utf8))
+                fprintf(fp, "\\u%04x", ch);
+            else
+                fputc(ch, fp);
+            break;
+        }
+    }
+    fputc('"', fp);
+}
+
+// 入力ファイルの合計
+static void vsk_sum_inputs(const std::vector<VskInputStats>& inputs,
+                           VskDwordLong& bytes_in, VskDwordLong& bytes_out, VskDwordLong& pages)
+{
+    bytes_in = bytes_out = pages = 0;
+    for (auto& input : inputs)
+    {
+        bytes_in += input.m_bytes_in;
+        bytes_out += input.m_bytes_out;
+        pages += input.m_pages;
+    }
+}
+
+// 人が読むための表を出力する
+void VskStats::print_text(FILE *fp) const
+{
+    VskDwordLong bytes_in, bytes_out, pages;
+    vsk_sum_inputs(m_inputs, bytes_in, bytes_out, pages);
+    const double wall = vsk_seconds(m_wall_ns);
+
+    fprintf(fp, "%-10s %10s %10s %10s\n", "stage", "wall (s)", "cpu (s)", "calls");
+    for (int i = 0; i < VSK_STAGE_COUNT; ++i)
+    {
+        const VskStageTime& time = m_stages[i];
+        fprintf(fp, "%-10s %10.3f %10.3f %10llu\n", s_stage_names[i],
+                vsk_seconds(time.m_wall_ns), vsk_seconds(time.m_cpu_ns),
+                (unsigned long long)time.m_calls);
+    }
+    fprintf(fp, "%-10s %10.3f %10.3f %10s\n", "total", wall, vsk_seconds(m_cpu_ns), "-");
+    fprintf(fp, "(raster and encode are summed over %d jobs)\n", m_jobs);
+    fprintf(fp, "files: %u, pages: %llu, pages/s: %.1f\n", unsigned(m_inputs.size()),
+            (unsigned long long)pages, (wall > 0) ? pages / wall : 0.0);
+    fprintf(fp, "glyphs: ank %llu, kanji %llu, bold %llu, reused %llu\n",
+            (unsigned long long)m_ank_glyphs, (unsigned long long)m_kanji_glyphs,
+            (unsigned long long)m_bold_glyphs, (unsigned long long)m_reused_glyphs);
+    fprintf(fp, "bytes: in %llu, out %llu\n", (unsigned long long)bytes_in, (unsigned long long)bytes_out);
+    if (m_format == "png")
+        fprintf(fp, "output: png level %d", m_png_level);
+    else
+        fprintf(fp, "output: %s", m_format.c_str());
+    fprintf(fp, ", raw %llu, encoded %llu (%.2f%%)\n",
+            (unsigned long long)m_raw_bytes, (unsigned long long)m_encoded_bytes,
+            m_raw_bytes ? 100.0 * m_encoded_bytes / m_raw_bytes : 0.0);
+    fprintf(fp, "duplicate pages: %llu\n", (unsigned long long)m_duplicate_pages);
+    if (m_cache_hits + m_cache_misses > 0)
+    {
+        fprintf(fp, "cache: hits %llu, misses %llu\n",
+                (unsigned long long)m_cache_hits, (unsigned long long)m_cache_misses);
+    }
+    fprintf(fp, "peak rss: %.1f MB\n", double(vsk_peak_rss()) / (1024 * 1024));
+}
+
+// JSONで出力する
+void VskStats::print_json(FILE *fp) const
+{
+    VskDwordLong bytes_in, bytes_out, pages;
+    vsk_sum_inputs(m_inputs, bytes_in, bytes_out, pages);
+    const double wall = vsk_seconds(m_wall_ns);
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"wall_seconds\": %.6f,\n", wall);
+    fprintf(fp, "  \"cpu_seconds\": %.6f,\n", vsk_seconds(m_cpu_ns));
+    fprintf(fp, "  \"jobs\": %d,\n", m_jobs);
+    fprintf(fp, "  \"stages\": {\n");
+    for (int i = 0; i < VSK_STAGE_COUNT; ++i)
+    {
+        const VskStageTime& time = m_stages[i];
+        fprintf(fp, "    \"%s\": { \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"calls\": %llu }%s\n",
+                s_stage_names[i], vsk_seconds(time.m_wall_ns), vsk_seconds(time.m_cpu_ns),
+                (unsigned long long)time.m_calls, (i + 1 < VSK_STAGE_COUNT) ? "," : "");
+    }
+    fprintf(fp, "  },\n");
+    fprintf(fp, "  \"glyphs\": { \"ank\": %llu, \"kanji\": %llu, \"bold\": %llu, \"reused\": %llu },\n",
+            (unsigned long long)m_ank_glyphs, (unsigned long long)m_kanji_glyphs,
+            (unsigned long long)m_bold_glyphs, (unsigned long long)m_reused_glyphs);
+    fprintf(fp, "  \"cache\": { \"hits\": %llu, \"misses\": %llu },\n",
+            (unsigned long long)m_cache_hits, (unsigned long long)m_cache_misses);
+    fprintf(fp, "  \"output\": { \"format\": \"%s\", ", m_format.c_str());
+    if (m_format == "png")
+        fprintf(fp, "\"level\": %d, ", m_png_level);
+    fprintf(fp, "\"raw_bytes\": %llu, \"encoded_bytes\": %llu, \"ratio\": %.6f },\n",
+            (unsigned long long)m_raw_bytes, (unsigned long long)m_encoded_bytes,
+            m_raw_bytes ? double(m_encoded_bytes) / m_raw_bytes : 0.0);
+    fprintf(fp, "  \"duplicate_pages\": %llu,\n", (unsigned long long)m_duplicate_pages);
+    fprintf(fp, "  \"pages\": %llu,\n", (unsigned long long)pages);
+    fprintf(fp, "  \"pages_per_second\": %.3f,\n", (wall > 0) ? pages / wall : 0.0);
+    fprintf(fp, "  \"bytes_in\": %llu,\n", (unsigned long long)bytes_in);
+    fprintf(fp, "  \"bytes_out\": %llu,\n", (unsigned long long)bytes_out);
+    fprintf(fp, "  \"peak_rss_bytes\": %llu,\n", (unsigned long long)vsk_peak_rss());
+    fprintf(fp, "  \"inputs\": [");
+    for (size_t i = 0; i < m_inputs.size(); ++i)
+    {
+        const VskInputStats& input = m_inputs[i];
+        fprintf(fp, "%s\n    { \"name\": ", i ? "," : "");
+        vsk_print_json_string(fp, input.m_name);
+        fprintf(fp, ", \"pages\": %d, \"bytes_in\": %llu, \"bytes_out\": %llu, \"seconds\": %.6f }",
+                input.m_pages, (unsigned long long)input.m_bytes_in,
+                (unsigned long long)input.m_bytes_out, input.m_seconds);
+    }
+    fprintf(fp, "%s]\n", m_inputs.empty() ? "" : "\n  ");
+    fprintf(fp, "}\n");
+}
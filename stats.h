@@ -0,0 +1,116 @@
+// stats.h --- 変換の統計（--stats）
+#pragma once
+
+#include "types.h"
+#include <atomic>
+#include <cstdio>
+
+// 変換の段階
+enum VSK_STAGE
+{
+    VSK_STAGE_READ,         // 入力ファイルの読み込み
+    VSK_STAGE_PAGINATE,     // ページ分割
+    VSK_STAGE_RASTER,       // ページの描画
+    VSK_STAGE_ENCODE,       // PNGの圧縮
+    VSK_STAGE_WRITE,        // 出力先への書き込み
+    VSK_STAGE_COUNT
+};
+
+// 段階ごとの累計時間。複数のワーカーで実行される段階は全スレッドの合計になる
+struct VskStageTime
+{
+    std::atomic<VskDwordLong> m_wall_ns { 0 };  // 経過時間（ナノ秒）
+    std::atomic<VskDwordLong> m_cpu_ns { 0 };   // スレッドのCPU時間（ナノ秒）
+    std::atomic<VskDwordLong> m_calls { 0 };    // 回数
+};
+
+// 入力ファイルごとの統計
+struct VskInputStats
+{
+    std::string m_name;             // 入力ファイル名
+    VskDwordLong m_bytes_in = 0;    // 入力のバイト数
+    VskDwordLong m_bytes_out = 0;   // 出力のバイト数
+    int m_pages = 0;                // ページ数
+    double m_seconds = 0;           // 変換にかかった時間（秒）
+};
+
+// 変換全体の統計。段階の時間とグリフ数はワーカーから同時に加算してよい
+struct VskStats
+{
+    VskStageTime m_stages[VSK_STAGE_COUNT];
+    std::atomic<VskDwordLong> m_ank_glyphs { 0 };   // 出力した全ページの半角文字の数
+    std::atomic<VskDwordLong> m_kanji_glyphs { 0 }; // 出力した全ページの全角文字の数
+    std::atomic<VskDwordLong> m_bold_glyphs { 0 };  // そのうち太字の数
+    std::atomic<VskDwordLong> m_reused_glyphs { 0 }; // そのうち描画せずに使い回したページの文字の数
+    std::atomic<VskDwordLong> m_cache_hits { 0 };   // キャッシュにあったページ数
+    std::atomic<VskDwordLong> m_cache_misses { 0 }; // キャッシュになかったページ数
+    std::atomic<VskDwordLong> m_duplicate_pages { 0 }; // 前のページを使い回したページ数
+    std::atomic<VskDwordLong> m_raw_bytes { 0 };    // 変換したページの1ビットの画像のバイト数
+    std::atomic<VskDwordLong> m_encoded_bytes { 0 }; // 変換したページの画像ファイルのバイト数
+    std::vector<VskInputStats> m_inputs;            // 入力ファイルごとの統計
+    VskDwordLong m_start_ns = 0;                    // 開始時刻
+    VskDwordLong m_start_cpu_ns = 0;                // 開始時のプロセスのCPU時間
+    VskDwordLong m_wall_ns = 0;                     // 全体の経過時間
+    VskDwordLong m_cpu_ns = 0;                      // プロセスのCPU時間
+    int m_jobs = 1;                                 // スレッド数
+    std::string m_format = "png";                   // 出力の形式
+    int m_png_level = 6;                            // PNGの圧縮レベル
+
+    // 全体の計測を開始する
+    void begin();
+    // 全体の計測を終了する
+    void end();
+
+    // 段階に時間を1回分加算する
+    void add_time(VSK_STAGE stage, VskDwordLong wall_ns, VskDwordLong cpu_ns)
+    {
+        VskStageTime& time = m_stages[stage];
+        time.m_wall_ns += wall_ns;
+        time.m_cpu_ns += cpu_ns;
+        ++time.m_calls;
+    }
+
+    // 人が読むための表を出力する
+    void print_text(FILE *fp) const;
+    // JSONで出力する
+    void print_json(FILE *fp) const;
+};
+
+// 現在時刻（ナノ秒）
+VskDwordLong vsk_now_ns();
+// 現在のスレッドのCPU時間（ナノ秒）
+VskDwordLong vsk_thread_cpu_ns();
+// プロセスのCPU時間（ナノ秒）
+VskDwordLong vsk_process_cpu_ns();
+// プロセスの最大常駐メモリー（バイト数）
+VskDwordLong vsk_peak_rss();
+
+// スコープの間の時間を段階に加算する。statsがnullptrなら何もしない
+struct VskStageTimer
+{
+    VskStats *m_stats;
+    VSK_STAGE m_stage;
+    VskDwordLong m_start_ns = 0;
+    VskDwordLong m_start_cpu_ns = 0;
+
+    VskStageTimer(VskStats *stats, VSK_STAGE stage) : m_stats(stats), m_stage(stage)
+    {
+        if (m_stats)
+        {
+            m_start_ns = vsk_now_ns();
+            m_start_cpu_ns = vsk_thread_cpu_ns();
+        }
+    }
+    ~VskStageTimer()
+    {
+        if (m_stats)
+        {
+            VskStageTime& time = m_stats->m_stages[m_stage];
+            time.m_wall_ns += vsk_now_ns() - m_start_ns;
+            time.m_cpu_ns += vsk_thread_cpu_ns() - m_start_cpu_ns;
+            ++time.m_calls;
+        }
+    }
+    VskStageTimer(const VskStageTimer&) = delete;
+    VskStageTimer& operator=(const VskStageTimer&) = delete;
+};
@@ -0,0 +1,115 @@
+// thread_pool.cpp --- ワークスティーリング方式のスレッドプール
+#include "thread_pool.h"
+#include <algorithm>
+
+namespace {
+
+// 現在のスレッドが属するプールとワーカーの番号
+thread_local VskThreadPool *s_current_pool = nullptr;
+thread_local int s_current_index = -1;
+
+} // namespace
+
+// コンストラクタ
+VskThreadPool::VskThreadPool(int threads)
+{
+    if (threads <= 0)
+        threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+    for (int i = 0; i < threads; ++i)
+        m_queues.emplace_back(new Queue);
+    for (int i = 0; i < threads; ++i)
+        m_threads.emplace_back([this, i]() { run(i); });
+}
+
+// デストラクタ。残っているタスクを終えてからスレッドを止める
+VskThreadPool::~VskThreadPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+// タスクを追加する
+void VskThreadPool::submit(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t index = (s_current_pool == this) ? size_t(s_current_index) : (m_next++ % m_queues.size());
+        std::lock_guard<std::mutex> queue_lock(m_queues[index]->m_mutex);
+        m_queues[index]->m_tasks.push_back(std::move(task));
+        ++m_queued;
+        ++m_pending;
+    }
+    m_cond.notify_one();
+}
+
+// すべてのタスクが終わるまで待つ
+void VskThreadPool::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]() { return m_pending == 0; });
+}
+
+// タスクを取り出す。自分のキューは後ろから、他のキューは前から取る
+bool VskThreadPool::pop(int index, Task& task)
+{
+    const int count = int(m_queues.size());
+    for (int k = 0; k < count; ++k)
+    {
+        Queue& queue = *m_queues[(index + k) % count];
+        std::lock_guard<std::mutex> lock(queue.m_mutex);
+        if (queue.m_tasks.empty())
+            continue;
+        if (k == 0)
+        {
+            task = std::move(queue.m_tasks.back());
+            queue.m_tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.m_tasks.front());
+            queue.m_tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+// ワーカーの処理
+void VskThreadPool::run(int index)
+{
+    s_current_pool = this;
+    s_current_index = index;
+
+    for (;;)
+    {
+        Task task;
+        if (pop(index, task))
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_queued;
+            }
+            task(index);
+            bool idle;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                idle = (--m_pending == 0);
+            }
+            if (idle)
+                m_idle.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return m_queued > 0 || m_quit; });
+        if (m_quit && m_queued == 0)
+            break;
+    }
+}
@@ -0,0 +1,52 @@
+// thread_pool.h --- ワークスティーリング方式のスレッドプール
+#pragma once
+
+#include "types.h"
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// スレッドプール。ワーカーごとにタスクの両端キューを持ち、
+// 自分のキューが空になったら他のワーカーのキューから盗む
+struct VskThreadPool
+{
+    // タスク。引数はワーカーの番号（0～size()-1）
+    typedef std::function<void(int)> Task;
+
+    // ワーカーごとのタスクキュー
+    struct Queue
+    {
+        std::mutex m_mutex;
+        std::deque<Task> m_tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue> > m_queues;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;                 // 以下のメンバーを保護する
+    std::condition_variable m_cond;     // タスクが追加されたか終了要求
+    std::condition_variable m_idle;     // すべてのタスクが終わった
+    size_t m_queued = 0;                // キューにあるタスクの数
+    size_t m_pending = 0;               // 未完了のタスクの数
+    size_t m_next = 0;                  // 外部から追加するときのキュー
+    bool m_quit = false;
+
+    // threadsが0以下ならハードウェアのスレッド数を使う
+    explicit VskThreadPool(int threads);
+    ~VskThreadPool();
+
+    // ワーカーの数
+    int size() const
+    {
+        return int(m_threads.size());
+    }
+
+    // タスクを追加する。ワーカーの中から呼ばれたらそのワーカーのキューに積む
+    void submit(Task task);
+    // すべてのタスクが終わるまで待つ
+    void wait();
+
+protected:
+    void run(int index);
+    bool pop(int index, Task& task);
+};
@@ -0,0 +1,396 @@
+// tiff.cpp --- CCITT G4圧縮のTIFFエンコーダー
+#include "tiff.h"
+#include <climits>
+#include <cstring>
+
+namespace {
+
+// 符号（下位bitsビットをMSBから出力する）
+struct VskFaxCode
+{
+    VskWord m_code;
+    VskWord m_bits;
+};
+
+// 白のターミネーティング符号（0～63）
+const VskFaxCode s_white_term[64] =
+{
+    { 0x035,  8 }, { 0x007,  6 }, { 0x007,  4 }, { 0x008,  4 }, { 0x00B,  4 }, { 0x00C,  4 }, { 0x00E,  4 }, { 0x00F,  4 },
+    { 0x013,  5 }, { 0x014,  5 }, { 0x007,  5 }, { 0x008,  5 }, { 0x008,  6 }, { 0x003,  6 }, { 0x034,  6 }, { 0x035,  6 },
+    { 0x02A,  6 }, { 0x02B,  6 }, { 0x027,  7 }, { 0x00C,  7 }, { 0x008,  7 }, { 0x017,  7 }, { 0x003,  7 }, { 0x004,  7 },
+    { 0x028,  7 }, { 0x02B,  7 }, { 0x013,  7 }, { 0x024,  7 }, { 0x018,  7 }, { 0x002,  8 }, { 0x003,  8 }, { 0x01A,  8 },
+    { 0x01B,  8 }, { 0x012,  8 }, { 0x013,  8 }, { 0x014,  8 }, { 0x015,  8 }, { 0x016,  8 }, { 0x017,  8 }, { 0x028,  8 },
+    { 0x029,  8 }, { 0x02A,  8 }, { 0x02B,  8 }, { 0x02C,  8 }, { 0x02D,  8 }, { 0x004,  8 }, { 0x005,  8 }, { 0x00A,  8 },
+    { 0x00B,  8 }, { 0x052,  8 }, { 0x053,  8 }, { 0x054,  8 }, { 0x055,  8 }, { 0x024,  8 }, { 0x025,  8 }, { 0x058,  8 },
+    { 0x059,  8 }, { 0x05A,  8 }, { 0x05B,  8 }, { 0x04A,  8 }, { 0x04B,  8 }, { 0x032,  8 }, { 0x033,  8 }, { 0x034,  8 },
+};
+
+// 白のメイクアップ符号（64～1728）
+const VskFaxCode s_white_makeup[27] =
+{
+    { 0x01B,  5 }, { 0x012,  5 }, { 0x017,  6 }, { 0x037,  7 }, { 0x036,  8 }, { 0x037,  8 }, { 0x064,  8 }, { 0x065,  8 },
+    { 0x068,  8 }, { 0x067,  8 }, { 0x0CC,  9 }, { 0x0CD,  9 }, { 0x0D2,  9 }, { 0x0D3,  9 }, { 0x0D4,  9 }, { 0x0D5,  9 },
+    { 0x0D6,  9 }, { 0x0D7,  9 }, { 0x0D8,  9 }, { 0x0D9,  9 }, { 0x0DA,  9 }, { 0x0DB,  9 }, { 0x098,  9 }, { 0x099,  9 },
+    { 0x09A,  9 }, { 0x018,  6 }, { 0x09B,  9 },
+};
+
+// 黒のターミネーティング符号（0～63）
+const VskFaxCode s_black_term[64] =
+{
+    { 0x037, 10 }, { 0x002,  3 }, { 0x003,  2 }, { 0x002,  2 }, { 0x003,  3 }, { 0x003,  4 }, { 0x002,  4 }, { 0x003,  5 },
+    { 0x005,  6 }, { 0x004,  6 }, { 0x004,  7 }, { 0x005,  7 }, { 0x007,  7 }, { 0x004,  8 }, { 0x007,  8 }, { 0x018,  9 },
+    { 0x017, 10 }, { 0x018, 10 }, { 0x008, 10 }, { 0x067, 11 }, { 0x068, 11 }, { 0x06C, 11 }, { 0x037, 11 }, { 0x028, 11 },
+    { 0x017, 11 }, { 0x018, 11 }, { 0x0CA, 12 }, { 0x0CB, 12 }, { 0x0CC, 12 }, { 0x0CD, 12 }, { 0x068, 12 }, { 0x069, 12 },
+    { 0x06A, 12 }, { 0x06B, 12 }, { 0x0D2, 12 }, { 0x0D3, 12 }, { 0x0D4, 12 }, { 0x0D5, 12 }, { 0x0D6, 12 }, { 0x0D7, 12 },
+    { 0x06C, 12 }, { 0x06D, 12 }, { 0x0DA, 12 }, { 0x0DB, 12 }, { 0x054, 12 }, { 0x055, 12 }, { 0x056, 12 }, { 0x057, 12 },
+    { 0x064, 12 }, { 0x065, 12 }, { 0x052, 12 }, { 0x053, 12 }, { 0x024, 12 }, { 0x037, 12 }, { 0x038, 12 }, { 0x027, 12 },
+    { 0x028, 12 }, { 0x058, 12 }, { 0x059, 12 }, { 0x02B, 12 }, { 0x02C, 12 }, { 0x05A, 12 }, { 0x066, 12 }, { 0x067, 12 },
+};
+
+// 黒のメイクアップ符号（64～1728）
+const VskFaxCode s_black_makeup[27] =
+{
+    { 0x00F, 10 }, { 0x0C8, 12 }, { 0x0C9, 12 }, { 0x05B, 12 }, { 0x033, 12 }, { 0x034, 12 }, { 0x035, 12 }, { 0x06C, 13 },
+    { 0x06D, 13 }, { 0x04A, 13 }, { 0x04B, 13 }, { 0x04C, 13 }, { 0x04D, 13 }, { 0x072, 13 }, { 0x073, 13 }, { 0x074, 13 },
+    { 0x075, 13 }, { 0x076, 13 }, { 0x077, 13 }, { 0x052, 13 }, { 0x053, 13 }, { 0x054, 13 }, { 0x055, 13 }, { 0x05A, 13 },
+    { 0x05B, 13 }, { 0x064, 13 }, { 0x065, 13 },
+};
+
+// 白黒共通の拡張メイクアップ符号（1792～2560）
+const VskFaxCode s_extended_makeup[13] =
+{
+    { 0x008, 11 }, { 0x00C, 11 }, { 0x00D, 11 }, { 0x012, 12 }, { 0x013, 12 }, { 0x014, 12 }, { 0x015, 12 }, { 0x016, 12 },
+    { 0x017, 12 }, { 0x01C, 12 }, { 0x01D, 12 }, { 0x01E, 12 }, { 0x01F, 12 },
+};
+
+// 垂直モードの符号（a1 - b1 = -3～3）
+const VskFaxCode s_vertical[7] =
+{
+    { 0x002, 7 }, { 0x002, 6 }, { 0x002, 3 }, { 0x001, 1 }, { 0x003, 3 }, { 0x003, 6 }, { 0x003, 7 },
+};
+
+// TIFFのタグの型
+enum
+{
+    VSK_TIFF_SHORT = 3,
+    VSK_TIFF_LONG = 4,
+    VSK_TIFF_RATIONAL = 5,
+};
+
+// IFDのエントリーの数
+const int VSK_TIFF_ENTRIES = 12;
+
+// リトルエンディアンで値を読み書きする
+inline VskDword vsk_get_le16(const VskByte *p)
+{
+    return p[0] | (p[1] << 8);
+}
+inline VskDword vsk_get_le32(const VskByte *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (VskDword(p[3]) << 24);
+}
+inline void vsk_set_le32(VskByte *p, VskDword value)
+{
+    p[0] = VskByte(value);
+    p[1] = VskByte(value >> 8);
+    p[2] = VskByte(value >> 16);
+    p[3] = VskByte(value >> 24);
+}
+inline void vsk_push_le16(std::vector<VskByte>& data, VskDword value)
+{
+    data.push_back(VskByte(value));
+    data.push_back(VskByte(value >> 8));
+}
+inline void vsk_push_le32(std::vector<VskByte>& data, VskDword value)
+{
+    vsk_push_le16(data, value & 0xFFFF);
+    vsk_push_le16(data, value >> 16);
+}
+
+// IFDのエントリーを追加する
+inline void vsk_push_entry(std::vector<VskByte>& data, int tag, int type, VskDword count, VskDword value)
+{
+    vsk_push_le16(data, tag);
+    vsk_push_le16(data, type);
+    vsk_push_le32(data, count);
+    if (type == VSK_TIFF_SHORT)
+    {
+        vsk_push_le16(data, value);
+        vsk_push_le16(data, 0);
+    }
+    else
+    {
+        vsk_push_le32(data, value);
+    }
+}
+
+// 型の1個あたりのバイト数
+inline VskDword vsk_tiff_type_size(int type)
+{
+    switch (type)
+    {
+    case 1: case 2: case 6: case 7: return 1;   // BYTE, ASCII, SBYTE, UNDEFINED
+    case 3: case 8: return 2;                   // SHORT, SSHORT
+    case 4: case 9: case 11: return 4;          // LONG, SLONG, FLOAT
+    default: return 8;                          // RATIONAL, SRATIONAL, DOUBLE
+    }
+}
+
+// 8バイトをビッグエンディアンで読み込む（先頭のバイトが上位）
+inline VskDwordLong vsk_load_be64(const VskByte *p)
+{
+    VskDwordLong value;
+    std::memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+// 行の変化点（左隣と色が違うピクセルの位置）を列挙する。左端の外側は白とみなす。
+// 8バイトずつ調べ、白の続くところは飛ばす。末尾には番兵として幅を3つ置く
+void vsk_find_changes(const VskByte *bits, int width, std::vector<int>& changes)
+{
+    changes.clear();
+    const int size = (width + CHAR_BIT - 1) / CHAR_BIT;
+    VskDwordLong prev = 0; // 左隣のピクセル
+    for (int i = 0; i < size; i += 8)
+    {
+        VskDwordLong word;
+        if (i + 8 <= size)
+        {
+            word = vsk_load_be64(&bits[i]);
+        }
+        else
+        {
+            VskByte tail[8] = { 0 };
+            std::memcpy(tail, &bits[i], size - i);
+            word = vsk_load_be64(tail);
+        }
+        VskDwordLong t = word ^ ((word >> 1) | (prev << 63));
+        prev = word & 1;
+        while (t)
+        {
+            // 右端の余りのビットとの変化は数えない
+            int bit = __builtin_clzll(t);
+            int x = i * CHAR_BIT + bit;
+            if (x >= width)
+                break;
+            changes.push_back(x);
+            t &= ~(VskDwordLong(1) << (63 - bit));
+        }
+    }
+    changes.insert(changes.end(), 3, width);
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////////////
+// VskTiffWriter
+
+// ビットを書き込む
+inline void VskTiffWriter::put_bits(VskDword code, int bits)
+{
+    m_bitbuf = (m_bitbuf << bits) | code;
+    m_bitcount += bits;
+    while (m_bitcount >= CHAR_BIT)
+    {
+        m_bitcount -= CHAR_BIT;
+        m_out->push_back(VskByte(m_bitbuf >> m_bitcount));
+    }
+}
+
+// ランの長さを書き込む（color: 0なら白、1なら黒）
+void VskTiffWriter::put_run(int run, int color)
+{
+    const VskFaxCode *term = color ? s_black_term : s_white_term;
+    const VskFaxCode *makeup = color ? s_black_makeup : s_white_makeup;
+    while (run >= 2560 + 64)
+    {
+        const VskFaxCode& code = s_extended_makeup[12];
+        put_bits(code.m_code, code.m_bits);
+        run -= 2560;
+    }
+    if (run >= 64)
+    {
+        const int m = run / 64;
+        const VskFaxCode& code = (m <= 27) ? makeup[m - 1] : s_extended_makeup[m - 28];
+        put_bits(code.m_code, code.m_bits);
+        run -= m * 64;
+    }
+    put_bits(term[run].m_code, term[run].m_bits);
+}
+
+// m_curをm_refを参照して2次元符号化する
+void VskTiffWriter::encode_row()
+{
+    const int *ref = m_ref.data();
+    const int *cur = m_cur.data();
+    int a0 = -1, color = 0; // colorはa0の色（0なら白、1なら黒）
+    size_t ia = 0, ib = 0;
+    while (a0 < m_width)
+    {
+        while (cur[ia] <= a0)
+            ++ia;
+        const int a1 = cur[ia];
+
+        // b1はa0より右にあってa0と逆の色に変わる参照行の変化点
+        while (ib > 0 && ref[ib - 1] > a0)
+            --ib;
+        while (ref[ib] <= a0 || int(ib & 1) != color)
+            ++ib;
+        const int b1 = ref[ib], b2 = ref[ib + 1];
+
+        if (b2 < a1)
+        {
+            put_bits(0x1, 4); // パスモード
+            a0 = b2;
+        }
+        else if (a1 - b1 >= -3 && a1 - b1 <= 3)
+        {
+            const VskFaxCode& code = s_vertical[a1 - b1 + 3]; // 垂直モード
+            put_bits(code.m_code, code.m_bits);
+            a0 = a1;
+            color ^= 1;
+        }
+        else
+        {
+            const int a2 = cur[ia + 1];
+            put_bits(0x1, 3); // 水平モード
+            put_run(a1 - (a0 < 0 ? 0 : a0), color);
+            put_run(a2 - a1, color ^ 1);
+            a0 = a2;
+        }
+    }
+    m_ref.swap(m_cur);
+    ++m_rows;
+}
+
+// 書き込みを開始する
+void VskTiffWriter::begin(int width, int height, std::vector<VskByte>& out)
+{
+    m_out = &out;
+    m_start = out.size();
+    m_width = width;
+    m_height = height;
+    m_rows = 0;
+    m_bitbuf = 0;
+    m_bitcount = 0;
+
+    // ヘッダー。IFDの位置は最後に書き込む
+    static const VskByte header[8] = { 'I', 'I', 42, 0, 0, 0, 0, 0 };
+    out.insert(out.end(), header, header + 8);
+
+    // 最初の行の参照行は白い行
+    m_ref.assign(3, width);
+}
+
+// 1ビットの行を書き込む（MSBが左端、ビットが立っていれば黒）
+void VskTiffWriter::write_row(const VskByte *bits)
+{
+    assert(m_rows < m_height);
+    vsk_find_changes(bits, m_width, m_cur);
+    encode_row();
+}
+
+// 白い行を書き込む
+void VskTiffWriter::write_blank_row()
+{
+    assert(m_rows < m_height);
+    m_cur.assign(3, m_width);
+    encode_row();
+}
+
+// 書き込みを終了する
+void VskTiffWriter::end()
+{
+    assert(m_rows == m_height);
+    auto& out = *m_out;
+
+    // EOFB
+    put_bits(0x001, 12);
+    put_bits(0x001, 12);
+    if (m_bitcount)
+        put_bits(0, CHAR_BIT - m_bitcount);
+
+    const VskDword strip_size = VskDword(out.size() - m_start - 8);
+    if ((out.size() - m_start) & 1)
+        out.push_back(0);
+
+    // IFD
+    const VskDword ifd = VskDword(out.size() - m_start);
+    const VskDword resolution = ifd + 2 + VSK_TIFF_ENTRIES * 12 + 4;
+    vsk_set_le32(&out[m_start + 4], ifd);
+    vsk_push_le16(out, VSK_TIFF_ENTRIES);
+    vsk_push_entry(out, 256, VSK_TIFF_LONG, 1, m_width);            // ImageWidth
+    vsk_push_entry(out, 257, VSK_TIFF_LONG, 1, m_height);           // ImageLength
+    vsk_push_entry(out, 258, VSK_TIFF_SHORT, 1, 1);                 // BitsPerSample
+    vsk_push_entry(out, 259, VSK_TIFF_SHORT, 1, 4);                 // Compression: CCITT T.6
+    vsk_push_entry(out, 262, VSK_TIFF_SHORT, 1, 0);                 // PhotometricInterpretation: WhiteIsZero
+    vsk_push_entry(out, 273, VSK_TIFF_LONG, 1, 8);                  // StripOffsets
+    vsk_push_entry(out, 277, VSK_TIFF_SHORT, 1, 1);                 // SamplesPerPixel
+    vsk_push_entry(out, 278, VSK_TIFF_LONG, 1, m_height);           // RowsPerStrip
+    vsk_push_entry(out, 279, VSK_TIFF_LONG, 1, strip_size);         // StripByteCounts
+    vsk_push_entry(out, 282, VSK_TIFF_RATIONAL, 1, resolution);     // XResolution
+    vsk_push_entry(out, 283, VSK_TIFF_RATIONAL, 1, resolution + 8); // YResolution
+    vsk_push_entry(out, 296, VSK_TIFF_SHORT, 1, 2);                 // ResolutionUnit: インチ
+    vsk_push_le32(out, 0);                                          // 次のIFD
+    for (int i = 0; i < 2; ++i)
+    {
+        vsk_push_le32(out, 96);
+        vsk_push_le32(out, 1);
+    }
+    m_out = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// VskMultiPageTiff
+
+// 空にする
+void VskMultiPageTiff::clear()
+{
+    m_data.clear();
+    m_next_ifd = 4;
+}
+
+// 1ページのTIFFを最後のページとして追加する。IFDの位置などはずらして書き直す
+bool VskMultiPageTiff::append(const std::vector<VskByte>& page)
+{
+    if (page.size() < 8 || std::memcmp(page.data(), "II*\0", 4) != 0)
+        return false;
+    const VskDword ifd = vsk_get_le32(&page[4]);
+    if (ifd < 8 || ifd + 2 > page.size())
+        return false;
+    const VskDword count = vsk_get_le16(&page[ifd]);
+    if (ifd + 2 + count * 12 + 4 > page.size())
+        return false;
+
+    if (m_data.empty())
+    {
+        static const VskByte header[8] = { 'I', 'I', 42, 0, 0, 0, 0, 0 };
+        m_data.assign(header, header + 8);
+        m_next_ifd = 4;
+    }
+    if (m_data.size() & 1)
+        m_data.push_back(0);
+
+    // ページの先頭のヘッダーを除いてつなげる
+    const VskDwordLong base = m_data.size();
+    if (base + page.size() > 0xFFFFFFFF)
+        return false;
+    const VskDword delta = VskDword(base - 8);
+    m_data.insert(m_data.end(), page.begin() + 8, page.end());
+
+    VskByte *entry = &m_data[ifd + delta + 2];
+    for (VskDword i = 0; i < count; ++i, entry += 12)
+    {
+        const int tag = vsk_get_le16(entry), type = vsk_get_le16(entry + 2);
+        const VskDword n = vsk_get_le32(entry + 4);
+        if (tag == 273 || VskDwordLong(n) * vsk_tiff_type_size(type) > 4)
+            vsk_set_le32(entry + 8, vsk_get_le32(entry + 8) + delta);
+    }
+
+    vsk_set_le32(&m_data[m_next_ifd], ifd + delta);
+    m_next_ifd = ifd + delta + 2 + count * 12;
+    return true;
+}
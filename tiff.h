@@ -0,0 +1,45 @@
+// tiff.h --- CCITT G4圧縮のTIFFエンコーダー
+#pragma once
+
+#include "image_writer.h"
+
+// 1ページのTIFF（CCITT T.6、いわゆるFAXのG4圧縮）のエンコーダー。
+// 前の行を参照して変化点の位置の差を符号化するので、白い行や同じ形の続く文字の画像はとても小さくなる
+struct VskTiffWriter : VskImageWriter
+{
+    std::vector<VskByte> *m_out = nullptr;      // 出力先
+    size_t m_start = 0;                         // 出力先でのTIFFの先頭の位置
+    std::vector<int> m_ref;                     // 参照行（前の行）の変化点。末尾に幅を3つ置く
+    std::vector<int> m_cur;                     // 符号化行の変化点
+    VskDwordLong m_bitbuf = 0;                  // ビットバッファ（MSBから詰める）
+    int m_bitcount = 0;                         // ビットバッファのビット数
+    int m_width = 0;                            // 画像の幅
+    int m_height = 0;                           // 画像の高さ
+    int m_rows = 0;                             // 書き込んだ行数
+
+    // 書き込みを開始する
+    void begin(int width, int height, std::vector<VskByte>& out) override;
+    // 1ビットの行を書き込む（MSBが左端、ビットが立っていれば黒）
+    void write_row(const VskByte *bits) override;
+    // 白い行を書き込む
+    void write_blank_row() override;
+    // 書き込みを終了する
+    void end() override;
+
+protected:
+    void encode_row();
+    void put_bits(VskDword code, int bits);
+    void put_run(int run, int color);
+};
+
+// 複数ページのTIFF。VskTiffWriterで作った1ページのTIFFを順に追加する
+struct VskMultiPageTiff
+{
+    std::vector<VskByte> m_data;                // TIFFファイルの内容
+    size_t m_next_ifd = 4;                      // 次のページのIFDの位置を書き込む場所
+
+    // 空にする
+    void clear();
+    // 1ページのTIFFを最後のページとして追加する。IFDの位置などはずらして書き直す
+    bool append(const std::vector<VskByte>& page);
+};
@@ -1,16 +1,21 @@
 // License: MIT
-#include <windows.h>
-#include <windowsx.h>
-
-// イメージハンドル
-typedef HBITMAP VskImageHandle;
-
+#ifdef _WIN32
+    #include <windows.h>
+#endif
+#include <cstdio>
+#include <algorithm>
+#include <climits>
+
+#include "framebuffer.h"
 #include "txt2png.h"
 #include "encoding.h"
+#include "glyph_cache.h"
+#include "font_atlas.h"
+#include "simd.h"
 
 void version(void)
 {
-    std::puts("txt2png by katahiromz Version 0.8");
+    std::puts("txt2png by katahiromz Version 0.9");
 }
 
 void usage(void)
@@ -21,19 +26,36 @@ void usage(void)
         "Options:\n"
         "    --help                Display this message\n"
         "    --version             Show version information\n"
-        "    -i INPUT              Specify input file (program list or text)\n"
+        "    -i INPUT              Specify input file (program list or text, - for stdin)\n"
+        "                          Repeat -i or give a directory to convert many files\n"
+        "    --list FILE           Read input file names from FILE (one per line, - for stdin)\n"
+        "    --encoding NAME       Input encoding: sjis, utf-8, euc-jp, iso-2022-jp or auto (default: sjis)\n"
+        "    --prefix PREFIX       Specify output file name prefix (default: output)\n"
+        "    -o OUTPUT             Write all pages into one stream (- for stdout)\n"
+        "    --tar                 Make the stream a tar archive (default: concatenated images)\n"
         "    --max-x COLUMNS       Specify column count (default: 120)\n"
         "    --max-y ROWS          Specify row count (default: 80)\n"
         "    --margin MARGIN       Specify margin in pixels (default: 16)\n"
         "    --8801                Use 8801 font\n"
         "    --bold                Use bold font\n"
+        "    --gray                Output 1-bit grayscale PNG (default: 2-color palette)\n"
+        "    --format FORMAT       Output format: png, pbm, pgm or tiff (CCITT G4) (default: png)\n"
+        "    --multipage           Make one multi-page TIFF per input (PREFIX.tif) instead of a file per page\n"
+        "    --jobs N              Render pages on N threads (default: 1, 0: all cores)\n"
+        "    --deflate-jobs N      Compress each page on N threads (default: 1, 0: all cores)\n"
+        "    --png-level LEVEL     PNG compression level: 0 (fastest) to 9 (smallest) (default: 6)\n"
+        "    --no-dedupe           Convert pages with the same content again (default: reuse)\n"
+        "    --report-duplicates   Report pages reused from an earlier page with the same content\n"
+        "    --cache-dir DIR       Reuse pages converted before from the cache in DIR\n"
+        "    --stats               Print per-stage timings, glyph counts, sizes and peak memory\n"
+        "    --stats-json FILE     Write the same statistics as JSON into FILE (- with progress messages)\n"
         "\n"
-        "Output files will be output-1.png, output-2.png etc.\n"
+        "Without -o, output files will be output-1.png, output-2.png etc. (.pbm, .pgm or .tif with --format).\n"
+        "With many inputs, they will be INPUT-1.png, INPUT-2.png etc. (PREFIXINPUT-1.png with --prefix).\n"
+        "With --multipage, each input becomes PREFIX.tif (output.tif), or INPUT.tif with many inputs.\n"
     );
 }
 
-typedef COLORREF VskSystemColor;
-
 // １バイト中のビット群を逆順にしたものを返す関数
 VskByte vsk_reverse_byte(VskByte x)
 {
@@ -101,43 +123,57 @@ VskWord vsk_sjis2jis(VskByte high, VskByte low)
     return ((VskWord(high) << 8) | low);
 }
 
-// XBMからビットの深さが1BPPのDIBビットマップを作成
+// フレームバッファを作成する（ピクセルはゼロで初期化される）
+VskImageHandle vsk_create_image(int width, int height, int bpp)
+{
+    if (width <= 0 || height <= 0)
+        return nullptr;
+    auto image = new VskFrameBuffer;
+    image->m_width = width;
+    image->m_height = height;
+    image->m_bpp = bpp;
+    image->m_pitch = ((width * bpp + 31) / 32) * 4; // DIBと同じく4バイト境界にそろえる
+    image->m_pixels.resize(size_t(image->m_pitch) * height);
+    return image;
+}
+
+// フレームバッファを破棄する
+void vsk_destroy_image(VskImageHandle image)
+{
+    delete image;
+}
+
+// XBMからビットの深さが1BPPのイメージを作成
 VskImageHandle vsk_create_1bpp_image_from_xbm(int width, int height, const void *bits)
 {
     assert(width % CHAR_BIT == 0);
-    size_t size = width / CHAR_BIT * height;
-    std::vector<VskByte> bytes;
-    bytes.resize(size);
-    memcpy(bytes.data(), bits, size);
-    for (auto& byte : bytes)
-        byte = vsk_reverse_byte(byte);
-    return CreateBitmap(width, height, 1, 1, bytes.data());
+    VskImageHandle image = vsk_create_image(width, height, 1);
+    if (!image)
+        return nullptr;
+    auto src = reinterpret_cast<const VskByte *>(bits);
+    for (int y = 0; y < height; ++y)
+    {
+        VskByte *row = image->row(y);
+        for (int x = 0; x < width / CHAR_BIT; ++x)
+            row[x] = vsk_reverse_byte(*src++);
+    }
+    return image;
 }
 
-// ビットの深さが32BPPのDIBビットマップを作成
+// ビットの深さが32BPPのイメージを作成
 VskImageHandle vsk_create_32bpp_image(int width, int height, void **ppvBits)
 {
-    BITMAPINFO bmi;
-    ZeroMemory(&bmi, sizeof(bmi));
-    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
-    bmi.bmiHeader.biWidth = width;
-    bmi.bmiHeader.biHeight = -height;
-    bmi.bmiHeader.biPlanes = 1;
-    bmi.bmiHeader.biBitCount = 32;
-    HDC hDC = CreateCompatibleDC(nullptr);
-    LPVOID pvBits;
-    HBITMAP hbm = CreateDIBSection(hDC, &bmi, DIB_RGB_COLORS, &pvBits, nullptr, 0);
+    VskImageHandle image = vsk_create_image(width, height, 32);
     if (ppvBits)
-        *ppvBits = pvBits;
-    DeleteDC(hDC);
-    return hbm;
+        *ppvBits = (image ? image->m_pixels.data() : nullptr);
+    return image;
 }
 
-// ビットマップをクリップボードにコピーする
-bool vsk_copy_image_to_clipboard(HWND hwnd, HBITMAP hBitmap)
+#ifdef _WIN32
+// イメージをクリップボードにコピーする
+bool vsk_copy_image_to_clipboard(HWND hwnd, VskImageHandle image)
 {
-    BITMAP bm;
-    if (!GetObject(hBitmap, sizeof(bm), &bm))
+    if (!image || image->m_bpp != 32)
     {
         assert(0);
         return false;
@@ -146,12 +182,12 @@ bool vsk_copy_image_to_clipboard(HWND hwnd, HBITMAP hBitmap)
     BITMAPINFO bmi;
     ZeroMemory(&bmi, sizeof(bmi));
     bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
-    bmi.bmiHeader.biWidth = bm.bmWidth;
-    bmi.bmiHeader.biHeight = bm.bmHeight;
+    bmi.bmiHeader.biWidth = image->m_width;
+    bmi.bmiHeader.biHeight = image->m_height;
     bmi.bmiHeader.biPlanes = 1;
     bmi.bmiHeader.biBitCount = 32;
 
-    SIZE_T cb = sizeof(BITMAPINFOHEADER) + bm.bmWidthBytes * bm.bmHeight;
+    SIZE_T cb = sizeof(BITMAPINFOHEADER) + image->m_pitch * image->m_height;
     HANDLE hDIB = GlobalAlloc(GHND | GMEM_SHARE, cb);
     if (!hDIB)
     {
@@ -169,9 +205,10 @@ bool vsk_copy_image_to_clipboard(HWND hwnd, HBITMAP hBitmap)
 
     CopyMemory(pb, &bmi, sizeof(BITMAPINFOHEADER));
 
-    HDC hDC = CreateCompatibleDC(NULL);
-    GetDIBits(hDC, hBitmap, 0, bm.bmHeight, pb + sizeof(BITMAPINFOHEADER), &bmi, DIB_RGB_COLORS);
-    DeleteDC(hDC);
+    // CF_DIBはボトムアップなので行を逆順にコピーする
+    BYTE *pbBits = pb + sizeof(BITMAPINFOHEADER);
+    for (int y = 0; y < image->m_height; ++y)
+        CopyMemory(pbBits + (image->m_height - 1 - y) * image->m_pitch, image->row(y), image->m_pitch);
 
     GlobalUnlock(hDIB);
 
@@ -199,6 +236,7 @@ bool vsk_copy_image_to_clipboard(HWND hwnd, HBITMAP hBitmap)
 
     return !!bOK;
 }
+#endif  // def _WIN32
 
 ////////////////////////////////////////////////////////////////////////////////////
 // VskImage
@@ -215,7 +253,7 @@ struct VskImage
 
     VskImage();
     VskImage(VskImageHandle image);
-    ~VskImage();
+    virtual ~VskImage();
 
     int width() const;
     int height() const;
@@ -241,14 +279,28 @@ struct Vsk1BppImage : VskImage
 {
     Vsk1BppImage();
     Vsk1BppImage(VskImageHandle image);
+    Vsk1BppImage(int width, int height);
     Vsk1BppImage(int width, int height, const void *bits);
+
+    VskSystemColor get_pixel(int x, int y) const override;
+    void set_pixel(int x, int y, VskSystemColor color) override;
+};
+
+// 32BPPのイメージを扱うクラス
+struct Vsk32BppImage : VskImage
+{
+    Vsk32BppImage();
+    Vsk32BppImage(VskImageHandle image);
+    Vsk32BppImage(int width, int height);
+
+    VskSystemColor get_pixel(int x, int y) const override;
+    void set_pixel(int x, int y, VskSystemColor color) override;
 };
 
 // VskImageの内部実装VskImageImpl
 struct VskImageImpl
 {
     VskImageHandle m_image = nullptr;
-    BITMAP m_bm = { 0 };
 };
 
 // イメージのハンドル
@@ -280,33 +332,32 @@ VskImage::~VskImage()
 // 幅（ピクセル単位）
 int VskImage::width() const
 {
-    return m_pimpl->m_bm.bmWidth;
+    return m_pimpl->m_image ? m_pimpl->m_image->m_width : 0;
 }
 
 // 高さ（ピクセル単位）
 int VskImage::height() const
 {
-    return m_pimpl->m_bm.bmHeight;
+    return m_pimpl->m_image ? m_pimpl->m_image->m_height : 0;
 }
 
 // ビットの深さ
 int VskImage::bpp() const
 {
-    return m_pimpl->m_bm.bmBitsPixel;
+    return m_pimpl->m_image ? m_pimpl->m_image->m_bpp : 0;
 }
 
 // イメージの横幅（バイト数）
 int VskImage::pitch() const
 {
-    return m_pimpl->m_bm.bmWidthBytes;
+    return m_pimpl->m_image ? m_pimpl->m_image->m_pitch : 0;
 }
 
 // イメージハンドルを取り付ける
 void VskImage::attach(VskImageHandle image)
 {
     destroy();
-    if (GetObject(image, sizeof(m_pimpl->m_bm), &m_pimpl->m_bm))
-        m_pimpl->m_image = image;
+    m_pimpl->m_image = image;
 }
 
 // イメージハンドルを取りはずす
@@ -322,7 +373,7 @@ void VskImage::destroy()
 {
     if (m_pimpl->m_image)
     {
-        DeleteObject(m_pimpl->m_image);
+        vsk_destroy_image(m_pimpl->m_image);
         m_pimpl->m_image = nullptr;
     }
 }
@@ -331,16 +382,14 @@ void VskImage::destroy()
 VskByte *VskImage::bits(size_t offset)
 {
     assert(m_pimpl->m_image);
-    assert(m_pimpl->m_bm.bmBits);
-    return reinterpret_cast<VskByte *>(m_pimpl->m_bm.bmBits) + offset;
+    return m_pimpl->m_image->m_pixels.data() + offset;
 }
 
 // イメージのデータを取得する
 const VskByte *VskImage::bits(size_t offset) const
 {
     assert(m_pimpl->m_image);
-    assert(m_pimpl->m_bm.bmBits);
-    return reinterpret_cast<VskByte *>(m_pimpl->m_bm.bmBits) + offset;
+    return m_pimpl->m_image->m_pixels.data() + offset;
 }
 
 // 座標(x, y)はイメージの内側か？
@@ -362,72 +411,99 @@ Vsk1BppImage::Vsk1BppImage(VskImageHandle image) : VskImage(image)
 {
 }
 
+// コンストラクタ（白いイメージを作る）
+Vsk1BppImage::Vsk1BppImage(int width, int height)
+{
+    attach(vsk_create_image(width, height, 1));
+}
+
 // コンストラクタ
 Vsk1BppImage::Vsk1BppImage(int width, int height, const void *bits)
 {
     attach(vsk_create_1bpp_image_from_xbm(width, height, bits));
 }
 
+// ピクセルを取得する（ビットが立っていれば黒）
+VskSystemColor Vsk1BppImage::get_pixel(int x, int y) const
+{
+    if (!inside(x, y))
+        return 0;
+    const VskByte *row = bits(size_t(y) * pitch());
+    return ((row[x / CHAR_BIT] << (x % CHAR_BIT)) & 0x80) ? VSK_COLOR_BLACK : VSK_COLOR_WHITE;
+}
+
+// ピクセルを設定する
+void Vsk1BppImage::set_pixel(int x, int y, VskSystemColor color)
+{
+    if (!inside(x, y))
+        return;
+    VskByte *row = bits(size_t(y) * pitch());
+    VskByte mask = VskByte(0x80 >> (x % CHAR_BIT));
+    if (color == VSK_COLOR_BLACK)
+        row[x / CHAR_BIT] |= mask;
+    else
+        row[x / CHAR_BIT] &= ~mask;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+// Vsk32BppImage
+
+// コンストラクタ
+Vsk32BppImage::Vsk32BppImage()
+{
+}
+
+// コンストラクタ
+Vsk32BppImage::Vsk32BppImage(VskImageHandle image) : VskImage(image)
+{
+}
+
+// コンストラクタ
+Vsk32BppImage::Vsk32BppImage(int width, int height)
+{
+    attach(vsk_create_32bpp_image(width, height, nullptr));
+}
+
+// ピクセルを取得する
+VskSystemColor Vsk32BppImage::get_pixel(int x, int y) const
+{
+    if (!inside(x, y))
+        return 0;
+    auto row = reinterpret_cast<const VskDword *>(bits(size_t(y) * pitch()));
+    return row[x];
+}
+
+// ピクセルを設定する
+void Vsk32BppImage::set_pixel(int x, int y, VskSystemColor color)
+{
+    if (!inside(x, y))
+        return;
+    auto row = reinterpret_cast<VskDword *>(bits(size_t(y) * pitch()));
+    row[x] = color;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////
 
-// ANK文字のピクセルを取得するクラス
-template <int t_width = 128, int t_height = 256>
+// ANK文字のグリフの行を取得するクラス。グリフは16行で1行1バイト（MSBが左端）
+template <bool t_is_8801>
 struct VskAnkGetter {
-    const VskByte *m_bits = nullptr;
-    VskAnkGetter() = default;
-    constexpr VskAnkGetter(int width, int height, const VskByte *bits) : m_bits(bits) {
-        assert(t_width == width);
-        assert(t_height == height);
-    }
-    constexpr void set(int width, int height, const VskByte *bits) {
-        m_bits = bits;
-        assert(t_width == width);
-        assert(t_height == height);
-    }
-    bool operator()(int x, int y) const {
-        if (0 <= x && x < t_width && 0 <= y && y < t_height) {
-            int offset = y * (t_width / CHAR_BIT) + x / CHAR_BIT;
-            auto& byte = m_bits[offset];
-            return ((byte >> (x % CHAR_BIT)) & 1);
-        }
-        return false;
+    const VskByte *operator()(VskByte ch) const {
+        return vsk_atlas_ank(t_is_8801, ch);
     }
 };
 
-// 8801っぽいANKのピクセルを取得するクラス
-struct Vsk8801AnkGetter : VskAnkGetter<> {
-    Vsk8801AnkGetter() {
-#include "img/pc88_chars.xbm"
-        set(pc88_chars_width, pc88_chars_height, pc88_chars_bits);
-    }
-};
+// 8801っぽいANKのグリフを取得するクラス
+struct Vsk8801AnkGetter : VskAnkGetter<true> { };
 
-// 9801っぽいANKのピクセルを取得するクラス
-struct Vsk9801AnkGetter : VskAnkGetter<> {
-    Vsk9801AnkGetter() {
-#include "img/pc98_chars.xbm"
-        set(pc98_chars_width, pc98_chars_height, pc98_chars_bits);
-    }
-};
+// 9801っぽいANKのグリフを取得するクラス
+struct Vsk9801AnkGetter : VskAnkGetter<false> { };
 
-// 全角文字のピクセルを取得するクラス
+// 全角文字のグリフの行を取得するクラス。グリフは16行で1行2バイト（MSBが左端）
 struct VskKanjiGetter {
-    const VskByte *m_bits = nullptr;
-    VskKanjiGetter() {
-#include "img/kanji_chars.xbm"
-        m_bits = kanji_chars_bits;
-    }
-    enum {
-        t_width = kanji_chars_width,
-        t_height = kanji_chars_height,
-    };
-    bool operator()(int x, int y) const {
-        if (0 <= x && x < t_width && 0 <= y && y < t_height) {
-            int offset = y * (t_width / CHAR_BIT) + x / CHAR_BIT;
-            auto& byte = m_bits[offset];
-            return ((byte >> (x % CHAR_BIT)) & 1);
-        }
-        return false;
+    const VskByte *operator()(VskWord jis) const {
+        static const VskByte s_blank[2 * VSK_GLYPH_HEIGHT] = { 0 };
+        const VskByte *glyph = vsk_atlas_kanji(jis);
+        return glyph ? glyph : s_blank;
     }
 };
 
@@ -441,11 +517,12 @@ struct VskNullPutter
 template <typename T_PUTTER, typename T_ERASER, typename T_GETTER>
 inline void vk_draw_ank(T_PUTTER& putter, T_ERASER& eraser, int x0, int y0, VskByte ch, const T_GETTER& getter, bool underline, bool upperline = false)
 {
-    auto xSrc = (ch & 0xF) * 8, ySrc = (ch >> 4) * 16;
+    const VskByte *glyph = getter(ch);
     for (int dy = 0, y = y0; dy < 16; ++y, ++dy) {
         bool flag = (upperline && dy == 0) || (underline && dy == 15);
+        VskByte bits = glyph[dy];
         for (int dx = 0, x = x0; dx < 8; ++x, ++dx) {
-            if (getter(xSrc + dx, ySrc + dy) | flag)
+            if (((bits << dx) & 0x80) || flag)
                 putter(x, y);
             else
                 eraser(x, y);
@@ -453,14 +530,15 @@ inline void vk_draw_ank(T_PUTTER& putter, T_ERASER& eraser, int x0, int y0, VskB
     }
 }
 
-// JISの全角文字を描画する(共通処理)
-template <typename T_GETTER, typename T_PUTTER, typename T_ERASER>
-inline void vk_draw_jis_generic(T_GETTER& getter, T_PUTTER& putter, T_ERASER& eraser, int x0, int y0, int x1, int y1, int xSrc, int ySrc, VskWord jis, bool underline, bool upperline = false)
+// JISの全角文字を描画する(共通処理)。左半分を(x0, y0)に、右半分を(x1, y1)に描く
+template <typename T_PUTTER, typename T_ERASER>
+inline void vk_draw_jis_generic(T_PUTTER& putter, T_ERASER& eraser, int x0, int y0, int x1, int y1, const VskByte *glyph, bool underline, bool upperline = false)
 {
     for (int dy = 0, y = y0; dy < 16; ++y, ++dy) {
         bool flag = (upperline && dy == 0) || (underline && dy == 15);
+        VskByte bits = glyph[2 * dy];
         for (int dx = 0, x = x0; dx < 8; ++x, ++dx) {
-            if (getter(xSrc + dx, ySrc + dy) | flag)
+            if (((bits << dx) & 0x80) || flag)
                 putter(x, y);
             else
                 eraser(x, y);
@@ -468,8 +546,9 @@ inline void vk_draw_jis_generic(T_GETTER& getter, T_PUTTER& putter, T_ERASER& er
     }
     for (int dy = 0, y = y1; dy < 16; ++y, ++dy) {
         bool flag = (upperline && dy == 0) || (underline && dy == 15);
-        for (int dx = 8, x = x1; dx < 16; ++x, ++dx) {
-            if (getter(xSrc + dx, ySrc + dy) | flag)
+        VskByte bits = glyph[2 * dy + 1];
+        for (int dx = 0, x = x1; dx < 8; ++x, ++dx) {
+            if (((bits << dx) & 0x80) || flag)
                 putter(x, y);
             else
                 eraser(x, y);
@@ -482,67 +561,24 @@ template <typename T_PUTTER, typename T_ERASER>
 inline void vk_draw_jis(T_PUTTER& putter, T_ERASER& eraser, int x0, int y0, int x1, int y1, VskWord jis, bool underline, bool upperline = false)
 {
     VskKanjiGetter getter;
-    auto xSrc = (vsk_low_byte(jis) - 0x21) * 16, ySrc = (vsk_high_byte(jis) - 0x21) * 16;
-    vk_draw_jis_generic(getter, putter, eraser, x0, y0, x1, y1, xSrc, ySrc, jis, underline, upperline);
+    vk_draw_jis_generic(putter, eraser, x0, y0, x1, y1, getter(jis), underline, upperline);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
 
-bool vsk_text_to_bitmap(VskTextToPng& text2png)
+// テキストを1ページ分走査し、文字ごとにコールバックを呼ぶ。
+// 改ページしたら次のページの開始位置をnextに格納してtrueを返す。
+// テキストの終わりに達したらfalseを返す。
+template <typename T_ON_ANK, typename T_ON_JIS>
+inline bool vsk_walk_page(std::string_view text, const VskPageStart& start, int max_x, int max_y,
+                          T_ON_ANK& on_ank, T_ON_JIS& on_jis, VskPageStart& next)
 {
-    std::string& text = text2png.m_text;
-    if (text.empty())
-        return false;
-
-    int max_x = text2png.m_max_x, max_y = text2png.m_max_y;
-    int margin = text2png.m_margin;
-    int page = text2png.m_page;
-    bool is_8801 = text2png.m_is_8801, bold = text2png.m_bold;
-
-    VskImageHandle& hbm = text2png.m_hbm;
-    hbm = nullptr;
-
-    const int char_width = (bold ? 9 : 8), char_height = 20;
-    int cx = char_width*max_x + 2*margin, cy = char_height*max_y + 2*margin;
-
-    HDC hDC;
-    HGDIOBJ hbmOld;
-    if (page > 0)
-    {
-        hbm = (HBITMAP)vsk_create_32bpp_image(cx, cy, nullptr);
-        if (!hbm)
-            return false;
-
-        hDC = CreateCompatibleDC(NULL);
-        hbmOld = SelectObject(hDC, hbm);
-        RECT rc = { 0, 0, cx, cy };
-        FillRect(hDC, &rc, GetStockBrush(WHITE_BRUSH));
-    }
-
-    VskNullPutter null_putter;
-    auto black_putter = [&](int x, int y) {
-        if (bold) {
-            SetPixel(hDC, x, y, RGB(0, 0, 0));
-            SetPixel(hDC, x + 1, y, RGB(0, 0, 0));
-        } else {
-            SetPixel(hDC, x, y, RGB(0, 0, 0));
-        }
-    };
-
-    Vsk8801AnkGetter getter88;
-    Vsk9801AnkGetter getter98;
-    auto getter = [&](int x, int y) {
-        if (is_8801)
-            return getter88(x, y);
-        return getter98(x, y);
-    };
-
-    int current_page = 1;
-    int x = 0, y = 0;
-    bool was_lead = false;
-    char lead = 0;
-    for (auto& ch : text)
+    int x = start.m_x, y = 0;
+    bool was_lead = start.m_was_lead;
+    VskByte lead = start.m_lead;
+    for (size_t i = start.m_offset; i < text.size(); ++i)
     {
+        VskByte ch = text[i];
         if (x >= max_x)
         {
             x = 0;
@@ -551,19 +587,15 @@ bool vsk_text_to_bitmap(VskTextToPng& text2png)
         if (was_lead)
         {
             was_lead = false;
-            int x0 = margin + char_width*(x - 1), y0 = margin + char_height*y;
             if (vsk_is_sjis_trail(ch))
             {
-                VskWord jis = vsk_sjis2jis(lead, ch);
-                if (page == current_page)
-                    vk_draw_jis(black_putter, null_putter, x0, y0, x0 + 8, y0, jis, false, false);
+                on_jis(x - 1, y, vsk_sjis2jis(lead, ch));
                 ++x;
                 continue;
             }
             else
             {
-                if (page == current_page)
-                    vk_draw_ank(black_putter, null_putter, x0, y0, lead, getter, false, false);
+                on_ank(x - 1, y, lead);
             }
         }
         if (ch == '\r')
@@ -574,10 +606,9 @@ bool vsk_text_to_bitmap(VskTextToPng& text2png)
             ++y;
             if (y >= max_y)
             {
-                x = y = 0;
-                if (current_page == page && page > 0)
-                    break;
-                ++current_page;
+                next = VskPageStart();
+                next.m_offset = i + 1;
+                return true;
             }
             continue;
         }
@@ -590,107 +621,989 @@ bool vsk_text_to_bitmap(VskTextToPng& text2png)
             continue;
         }
 
-        if (page == current_page)
+        on_ank(x, y, ch);
+        ++x;
+    }
+    return false;
+}
+
+// ページの先頭に戻す
+void VskPaginator::reset()
+{
+    m_x = m_y = 0;
+    m_was_lead = false;
+}
+
+// textを走査する。改ページしたらその改行の次までのバイト数をusedに格納してtrueを返す
+bool VskPaginator::feed(std::string_view text, size_t& used)
+{
+    const VskScanTextProc scan_text = vsk_pixel_kernels().m_scan_text;
+    auto data = reinterpret_cast<const VskByte *>(text.data());
+    const size_t size = text.size();
+
+    size_t i = 0;
+    while (i < size)
+    {
+        // 64バイトごとに改行とリードバイトの位置をビットマスクにして、その間の文字はまとめて進める。
+        // 折り返しは遅延するので、通算の位置 m_y * m_max_x + m_x は1文字ごとに1つ増える
+        const size_t base = i, end = i + std::min<size_t>(size - i, 64);
+        const VskDwordLong mask = (m_max_x > 0) ? scan_text(data + base, end - base) : ~VskDwordLong(0);
+        while (i < end)
         {
-            int x0 = margin + char_width*x, y0 = margin + char_height*y;
-            vk_draw_ank(black_putter, null_putter, x0, y0, ch, getter, false, false);
+            if (!m_was_lead)
+            {
+                VskDwordLong rest = mask >> (i - base);
+                size_t next = rest ? i + vsk_lowest_bit64(rest) : end;
+                if (next > i)
+                {
+                    VskDwordLong pos = VskDwordLong(m_y) * m_max_x + m_x + (next - i) - 1;
+                    m_y = int(pos / m_max_x);
+                    m_x = int(pos % m_max_x) + 1;
+                    i = next;
+                    if (i == end)
+                        break;
+                }
+            }
+
+            // ここからはvsk_walk_pageと同じ規則で1バイトずつ進める
+            VskByte ch = data[i++];
+            if (m_x >= m_max_x)
+            {
+                m_x = 0;
+                ++m_y;
+            }
+            if (m_was_lead)
+            {
+                m_was_lead = false;
+                if (vsk_is_sjis_trail(ch))
+                {
+                    ++m_x;
+                    continue;
+                }
+            }
+            if (ch == '\r')
+                continue;
+            if (ch == '\n')
+            {
+                m_x = 0;
+                ++m_y;
+                if (m_y >= m_max_y)
+                {
+                    reset();
+                    used = i;
+                    return true;
+                }
+                continue;
+            }
+            ++m_x;
+            if (vsk_is_sjis_lead(ch))
+            {
+                // 後続バイトがあればここで読む（ブロックの外にはみ出してもよい）
+                if (i < size && vsk_is_sjis_trail(data[i]))
+                {
+                    ++i;
+                    if (m_x >= m_max_x)
+                    {
+                        m_x = 0;
+                        ++m_y;
+                    }
+                    ++m_x;
+                }
+                else
+                {
+                    m_was_lead = true;
+                }
+            }
         }
-        ++x;
+    }
+    used = size;
+    return false;
+}
+
+// テキストを一度だけ走査してページ索引を作成する
+bool vsk_paginate(VskTextToPng& text2png)
+{
+    std::string_view text = text2png.m_text;
+    auto& page_starts = text2png.m_page_starts;
+    page_starts.clear();
+    if (text.empty())
+        return false;
+
+    VskPaginator paginator(text2png.m_max_x, text2png.m_max_y);
+    VskPageStart start;
+    page_starts.push_back(start);
+    size_t used;
+    while (paginator.feed(text.substr(start.m_offset), used))
+    {
+        start.m_offset += used;
+        page_starts.push_back(start);
     }
 
+    text2png.m_total_pages = int(page_starts.size());
+    return true;
+}
+
+bool vsk_text_to_bitmap(VskTextToPng& text2png)
+{
+    if (text2png.m_text.empty())
+        return false;
+
+    int page = text2png.m_page;
     if (page <= 0)
+        return vsk_paginate(text2png);
+
+    if (text2png.m_page_starts.empty())
+        vsk_paginate(text2png);
+
+    text2png.m_hbm = nullptr;
+    return vsk_render_page(text2png, page, text2png.m_hbm);
+}
+
+// ページの大きさ（ピクセル単位）を取得する
+void vsk_get_page_size(const VskTextToPng& text2png, int& cx, int& cy)
+{
+    const int char_width = (text2png.m_bold ? 9 : 8), char_height = 20;
+    cx = char_width*text2png.m_max_x + 2*text2png.m_margin;
+    cy = char_height*text2png.m_max_y + 2*text2png.m_margin;
+}
+
+// textのstartから1ページ分をbufferに描画する。文字の行がfirst_rowより上の部分は描画も消去もしない。
+// ink_rowsがあれば、その大きさが高さと同じときはインクのあった行だけを消し、描画したインクの行を格納する
+static bool vsk_render_page_from(const VskTextToPng& text2png, std::string_view text, const VskPageStart& start,
+                                 const VskPixelBuffer& buffer, VskGlyphCache *cache, int first_row = 0,
+                                 std::vector<VskByte> *ink_rows = nullptr)
+{
+    int max_x = text2png.m_max_x, max_y = text2png.m_max_y;
+    int margin = text2png.m_margin;
+    bool is_8801 = text2png.m_is_8801, bold = text2png.m_bold;
+
+    const int char_width = (bold ? 9 : 8), char_height = 20;
+    int cx, cy;
+    vsk_get_page_size(text2png, cx, cy);
+
+    const int bpp = buffer.m_bpp;
+    if (!buffer.m_bits || buffer.m_width < cx || buffer.m_height < cy)
+        return false;
+
+    // ページの範囲を白で塗りつぶす。グリフの高さは行の間隔より低いので、
+    // first_row行目の上端より上には描き直す文字のピクセルはない。
+    // 前回のインクの行がわかっていれば、その行だけを消せばよい
+    const int clear_top = (first_row > 0) ? std::min(cy, margin + char_height*first_row) : 0;
+    const VskByte *was_inked = nullptr;
+    if (ink_rows && first_row == 0 && int(ink_rows->size()) == cy)
+        was_inked = ink_rows->data();
+    void (*draw_glyph)(VskByte *, int, int, int, int, int, const VskGlyphTile&);
+    switch (bpp)
     {
-        text2png.m_total_pages = current_page;
-        return true;
+    case 32:
+        for (int y = clear_top; y < cy; ++y)
+        {
+            if (was_inked && !was_inked[y])
+                continue;
+            auto row = reinterpret_cast<VskDword *>(buffer.row(y));
+            std::fill(row, row + cx, VSK_COLOR_WHITE);
+        }
+        draw_glyph = vsk_draw_glyph_32bpp;
+        break;
+    case 8:
+        for (int y = clear_top; y < cy; ++y)
+        {
+            if (!was_inked || was_inked[y])
+                std::memset(buffer.row(y), 0, cx);
+        }
+        draw_glyph = vsk_draw_glyph_8bpp;
+        break;
+    case 1:
+        for (int y = clear_top; y < cy; ++y)
+        {
+            if (!was_inked || was_inked[y])
+                std::memset(buffer.row(y), 0, (cx + CHAR_BIT - 1) / CHAR_BIT);
+        }
+        draw_glyph = vsk_draw_glyph_1bpp;
+        break;
+    default:
+        return false;
+    }
+    VskByte *inked = nullptr;
+    if (ink_rows)
+    {
+        ink_rows->assign(cy, 0);
+        inked = ink_rows->data();
     }
 
-    SelectObject(hDC, hbmOld);
-    DeleteDC(hDC);
+    // 展開済みのグリフをフレームバッファに直接書き込む
+    static thread_local VskGlyphCache s_cache;
+    if (!cache)
+        cache = &s_cache;
+    cache->set_mode(is_8801, bold, bpp);
+
+    VskByte *bits = buffer.row(0);
+    const int pitch = buffer.m_pitch;
+    // 空白のグリフは描かない。インクを描いた行は記録する
+    auto draw = [&](int x, int y, const VskGlyphTile& tile) {
+        if (tile.is_blank())
+            return;
+        int x0 = margin + char_width*x, y0 = margin + char_height*y;
+        draw_glyph(bits, pitch, cx, cy, x0, y0, tile);
+        if (inked)
+        {
+            int top = std::max(0, y0 + tile.m_ink_top), bottom = std::min(cy, y0 + tile.m_ink_bottom);
+            if (top < bottom)
+                std::memset(inked + top, 1, bottom - top);
+        }
+    };
+    auto on_ank = [&](int x, int y, VskByte ch) {
+        if (y < first_row)
+            return;
+        draw(x, y, cache->ank(ch));
+    };
+    auto on_jis = [&](int x, int y, VskWord jis) {
+        if (y < first_row)
+            return;
+        draw(x, y, cache->kanji(jis));
+    };
+
+    // ページ索引を使って該当ページの先頭から描画する
+    VskPageStart next;
+    vsk_walk_page(text, start, max_x, max_y, on_ank, on_jis, next);
     return true;
 }
 
-#ifdef TXT2PNG_EXE
+// textのstartから1ページ分をimageに描画する。同じ大きさのイメージがあれば使い回す
+static bool vsk_render_page_from(const VskTextToPng& text2png, std::string_view text, const VskPageStart& start,
+                                 VskImageHandle& image, VskGlyphCache *cache)
+{
+    int cx, cy;
+    vsk_get_page_size(text2png, cx, cy);
+    const int bpp = text2png.m_bpp;
+    if (!image || image->m_width != cx || image->m_height != cy || image->m_bpp != bpp)
+    {
+        vsk_destroy_image(image);
+        image = vsk_create_image(cx, cy, bpp);
+        if (!image)
+            return false;
+    }
+    return vsk_render_page_from(text2png, text, start, VskPixelBuffer(*image), cache, 0, &image->m_ink_rows);
+}
+
+// ページ索引を使ってpage番目のページを描画する
+bool vsk_render_page(const VskTextToPng& text2png, int page, VskImageHandle& image, VskGlyphCache *cache)
+{
+    if (page <= 0 || page > int(text2png.m_page_starts.size()))
+        return false;
+    return vsk_render_page_from(text2png, text2png.m_text, text2png.m_page_starts[page - 1], image, cache);
+}
+
+// textの先頭から1ページ分を描画する
+bool vsk_render_page_text(const VskTextToPng& text2png, std::string_view text, VskImageHandle& image,
+                          VskGlyphCache *cache)
+{
+    return vsk_render_page_from(text2png, text, VskPageStart(), image, cache);
+}
+
+// ページ索引を使ってpage番目のページを呼び出し側のバッファに描画する
+bool vsk_render_page_to_buffer(const VskTextToPng& text2png, int page, const VskPixelBuffer& buffer,
+                               VskGlyphCache *cache)
+{
+    if (page <= 0 || page > int(text2png.m_page_starts.size()))
+        return false;
+    return vsk_render_page_from(text2png, text2png.m_text, text2png.m_page_starts[page - 1], buffer, cache);
+}
+
+// textの先頭から1ページ分を呼び出し側のバッファに描画する
+bool vsk_render_page_text_to_buffer(const VskTextToPng& text2png, std::string_view text,
+                                    const VskPixelBuffer& buffer, VskGlyphCache *cache)
+{
+    return vsk_render_page_from(text2png, text, VskPageStart(), buffer, cache);
+}
 
-#include <gdiplus.h>
-#pragma comment(lib, "gdiplus.lib")
+// textの先頭から1ページ分を、文字の行がfirst_row以降の部分だけ描画し直す
+bool vsk_render_page_text_rows(const VskTextToPng& text2png, std::string_view text, int first_row,
+                               const VskPixelBuffer& buffer, VskGlyphCache *cache)
+{
+    return vsk_render_page_from(text2png, text, VskPageStart(), buffer, cache, first_row);
+}
 
-// GDI+用。エンコーダーのCLSIDを取得する
-BOOL GetEncoderClsid(CLSID* pClsid, LPCWSTR mime_type)
+// textの先頭から1ページ分を、文字の行の高さずつの帯に描画してon_stripに渡す
+bool vsk_render_page_text_strips(const VskTextToPng& text2png, std::string_view text,
+                                 const VskStripCallback& on_strip, VskGlyphCache *cache)
 {
-    // エンコーダーのサイズ情報を取得
-    UINT cItems = 0, cbEncoders = 0;
-    Gdiplus::GetImageEncodersSize(&cItems, &cbEncoders);
-    if (!cbEncoders)
-        return FALSE; // 失敗
+    const int max_x = text2png.m_max_x, max_y = text2png.m_max_y;
+    const int margin = text2png.m_margin;
+    const int char_width = (text2png.m_bold ? 9 : 8), char_height = 20;
+    int cx, cy;
+    vsk_get_page_size(text2png, cx, cy);
+    if (cx <= 0 || cy <= 0)
+        return false;
 
-    // エンコーダーを格納するメモリーを確保
-    auto pEncoders = (Gdiplus::ImageCodecInfo *)malloc(cbEncoders);
-    if (!pEncoders)
-        return FALSE; // 失敗
+    // 余白が負ならグリフが帯をまたぐので、ページ全体を描画して1つの帯として渡す
+    if (margin < 0)
+    {
+        VskImageHandle image = nullptr;
+        bool ok = vsk_render_page_text(text2png, text, image, cache) &&
+                  on_strip(0, VskPixelBuffer(*image), image->m_ink_rows.data());
+        vsk_destroy_image(image);
+        return ok;
+    }
 
-    // エンコーダーを格納
-    Gdiplus::GetImageEncoders(cItems, cbEncoders, pEncoders);
+    const int bpp = text2png.m_bpp;
+    void (*draw_glyph)(VskByte *, int, int, int, int, int, const VskGlyphTile&);
+    switch (bpp)
+    {
+    case 32: draw_glyph = vsk_draw_glyph_32bpp; break;
+    case 8:  draw_glyph = vsk_draw_glyph_8bpp; break;
+    case 1:  draw_glyph = vsk_draw_glyph_1bpp; break;
+    default: return false;
+    }
 
-    // MIMEの種類に一致するエンコーダーのCLSIDを取得
-    for (UINT iItem = 0; iItem < cItems; ++iItem)
+    // 1行分の帯。インクのあった行だけを消して使い回す
+    static thread_local VskFrameBuffer s_strip;
+    VskFrameBuffer& strip = s_strip;
+    auto clear_row = [&](int y) {
+        if (bpp == 32)
+        {
+            auto row = reinterpret_cast<VskDword *>(strip.row(y));
+            std::fill(row, row + cx, VSK_COLOR_WHITE);
+        }
+        else
+        {
+            std::memset(strip.row(y), 0, strip.m_pitch);
+        }
+    };
+    if (strip.m_width != cx || strip.m_height != char_height || strip.m_bpp != bpp)
     {
-        if (wcscmp(pEncoders[iItem].MimeType, mime_type) == 0)
+        strip.m_width = cx;
+        strip.m_height = char_height;
+        strip.m_bpp = bpp;
+        strip.m_pitch = ((cx * bpp + 31) / 32) * 4;
+        strip.m_pixels.assign(size_t(strip.m_pitch) * char_height, 0);
+        strip.m_ink_rows.assign(char_height, 0);
+        for (int y = 0; y < char_height; ++y)
+            clear_row(y);
+    }
+
+    static thread_local VskGlyphCache s_cache;
+    if (!cache)
+        cache = &s_cache;
+    cache->set_mode(text2png.m_is_8801, text2png.m_bold, bpp);
+
+    // 帯の先頭のheight行を渡し、インクのあった行を消す
+    bool ok = true;
+    int top = 0;
+    auto emit = [&](int height) {
+        if (ok)
+            ok = on_strip(top, VskPixelBuffer(strip.row(0), cx, height, bpp, strip.m_pitch), strip.m_ink_rows.data());
+        top += height;
+        for (int y = 0; y < char_height; ++y)
         {
-            *pClsid = pEncoders[iItem].Clsid;
-            free(pEncoders); // 解放
-            return TRUE; // 成功
+            if (strip.m_ink_rows[y])
+            {
+                clear_row(y);
+                strip.m_ink_rows[y] = 0;
+            }
+        }
+    };
+    // 白い行をheight行だけ渡す
+    auto emit_blank = [&](int height) {
+        while (height > 0)
+        {
+            int rows = std::min(height, char_height);
+            emit(rows);
+            height -= rows;
         }
+    };
+
+    // 上の余白のあとは文字の行ごとの帯になる。最後の行で折り返した文字は下の余白に描かれるので、
+    // 帯はページの下端まで続け、はみ出す部分は切り取る
+    emit_blank(std::min(margin, cy));
+    const int rows = (cy - margin + char_height - 1) / char_height;
+    auto band_height = [&]() { return std::min(char_height, cy - top); };
+    int row = 0; // 描画中の文字の行
+    auto draw = [&](int x, int y, const VskGlyphTile& tile) {
+        if (y >= rows || !ok)
+            return;
+        for (; row < y; ++row)
+            emit(band_height());
+        if (tile.is_blank())
+            return;
+        const int height = band_height();
+        draw_glyph(strip.row(0), strip.m_pitch, cx, height, margin + char_width*x, 0, tile);
+        if (tile.m_ink_top < height)
+            std::memset(&strip.m_ink_rows[tile.m_ink_top], 1, std::min(tile.m_ink_bottom, height) - tile.m_ink_top);
+    };
+    auto on_ank = [&](int x, int y, VskByte ch) {
+        draw(x, y, cache->ank(ch));
+    };
+    auto on_jis = [&](int x, int y, VskWord jis) {
+        draw(x, y, cache->kanji(jis));
+    };
+    VskPageStart next;
+    vsk_walk_page(text, VskPageStart(), max_x, max_y, on_ank, on_jis, next);
+    for (; row < rows; ++row)
+        emit(band_height());
+    return ok;
+}
+
+// text2png.m_textの全ページを描画し、1ページごとにon_pageを呼ぶ
+bool vsk_render_pages(const VskTextToPng& text2png, const VskPageCallback& on_page, VskGlyphCache *cache)
+{
+    std::string_view text = text2png.m_text;
+    if (text.empty())
+        return false;
+
+    VskImageHandle image = nullptr;
+    VskPaginator paginator(text2png.m_max_x, text2png.m_max_y);
+    size_t offset = 0, used;
+    bool ok = true;
+    for (int page = 1; ok; ++page)
+    {
+        bool page_break = paginator.feed(text.substr(offset), used);
+        ok = vsk_render_page_text(text2png, text.substr(offset, used), image, cache) &&
+             on_page(page, VskPixelBuffer(*image));
+        offset += used;
+        if (!page_break)
+            break;
     }
+    vsk_destroy_image(image);
+    return ok;
+}
+
+// text2png.m_textの全ページを描画し、上から順に1行ずつon_rowを呼ぶ
+bool vsk_render_rows(const VskTextToPng& text2png, const VskRowCallback& on_row, VskGlyphCache *cache)
+{
+    return vsk_render_pages(text2png, [&](int page, const VskPixelBuffer& buffer) {
+        for (int y = 0; y < buffer.m_height; ++y)
+        {
+            if (!on_row(page, y, buffer.row(y)))
+                return false;
+        }
+        return true;
+    }, cache);
+}
+
+#ifdef TXT2PNG_EXE
+
+#include "png.h"
+#include "thread_pool.h"
+#include "input.h"
+#include "sink.h"
+#include "stats.h"
+#include "page_cache.h"
+#include "pnm.h"
+#include "tiff.h"
+#include <filesystem>
+
+// 1ページ分の変換結果
+struct VskPageOutput
+{
+    bool m_ok = false;              // 成功したか？
+    std::vector<VskByte> m_data;    // 画像ファイルのデータ
+    std::string m_cache_path;       // キャッシュにあったときはそのエントリーのパス（m_dataは空）
+    VskDwordLong m_cache_size = 0;  // キャッシュのエントリーのサイズ
+    int m_same_as = 0;              // 同じ内容の前のページの番号（なければ0。m_dataは空）
+};
+
+// 重複を調べるために覚えておくページ
+struct VskUniquePage
+{
+    std::string_view m_text;                // ページのテキスト
+    std::shared_ptr<std::string> m_owned;   // m_textを所有する文字列（マップしたファイルならnullptr）
+    std::string m_name;                     // 出力したファイル名
+    std::vector<VskByte> m_data;            // 画像ファイルのデータ（リンクできないとき）
+    VskDwordLong m_size = 0;                // 画像ファイルのサイズ
+};
+
+// 描画されるセルの並び。インクのない文字は除くので、空白や改行コードだけが違うページは同じになる
+static void vsk_page_cells(const VskTextToPng& text2png, std::string_view text, std::vector<VskDword>& cells)
+{
+    // アトラスですべての行が0のグリフは描画しても何も変わらない
+    static const auto s_blank_ank = []() {
+        std::vector<bool> blank(2 * 256);
+        for (int i = 0; i < 2 * 256; ++i)
+        {
+            const VskByte *glyph = vsk_atlas_ank(i >= 256, VskByte(i));
+            blank[i] = std::all_of(glyph, glyph + VSK_GLYPH_HEIGHT, [](VskByte b) { return b == 0; });
+        }
+        return blank;
+    }();
+    const int is_8801 = text2png.m_is_8801 ? 256 : 0;
+
+    cells.clear();
+    auto on_ank = [&](int x, int y, VskByte ch) {
+        if (s_blank_ank[is_8801 + ch])
+            return;
+        cells.push_back((VskDword(y) << 16) | VskWord(x));
+        cells.push_back(ch);
+    };
+    auto on_jis = [&](int x, int y, VskWord jis) {
+        const VskByte *glyph = vsk_atlas_kanji(jis);
+        if (glyph && std::all_of(glyph, glyph + 2 * VSK_GLYPH_HEIGHT, [](VskByte b) { return b == 0; }))
+            return;
+        cells.push_back((VskDword(y) << 16) | VskWord(x));
+        cells.push_back(0x10000 | jis);
+    };
+    VskPageStart next;
+    vsk_walk_page(text, VskPageStart(), text2png.m_max_x, text2png.m_max_y, on_ank, on_jis, next);
+}
+
+// セルの並びのハッシュ値（FNV-1a）
+static VskDwordLong vsk_hash_cells(const std::vector<VskDword>& cells)
+{
+    VskDwordLong hash = 14695981039346656037ull;
+    for (VskDword cell : cells)
+    {
+        hash ^= cell;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
 
-    free(pEncoders); // 解放
-    return FALSE; // 失敗
+// 出力するページの文字を数えて統計に加える。reusedならキャッシュや前のページを使い回したページ
+static void vsk_count_glyphs(const VskTextToPng& text2png, std::string_view text, VskStats& stats, bool reused)
+{
+    VskDwordLong ank = 0, kanji = 0;
+    auto on_ank = [&](int, int, VskByte) { ++ank; };
+    auto on_jis = [&](int, int, VskWord) { ++kanji; };
+    VskPageStart next;
+    vsk_walk_page(text, VskPageStart(), text2png.m_max_x, text2png.m_max_y, on_ank, on_jis, next);
+    stats.m_ank_glyphs += ank;
+    stats.m_kanji_glyphs += kanji;
+    if (text2png.m_bold)
+        stats.m_bold_glyphs += ank + kanji;
+    if (reused)
+        stats.m_reused_glyphs += ank + kanji;
 }
 
-// HBITMAPを画像ファイルとして保存する関数
-BOOL SaveHBITMAPToFile(HBITMAP hBitmap, LPCWSTR filename, LPCWSTR mime_type = L"image/png")
+// ファイルを変換する。スレッドプール、エンコーダー、イメージ、グリフキャッシュは
+// 入力ファイル間で使い回すので、たくさんの小さなファイルを続けて変換しても速い
+struct VskConverter
 {
-    // GDI+ BitmapオブジェクトをHBITMAPから作成
-    auto bitmap = new Gdiplus::Bitmap(hBitmap, NULL);
-    if (!bitmap)
-        return FALSE; // 失敗
-    std::shared_ptr<Gdiplus::Bitmap> pBitmap(bitmap);
+    VskTextToPng m_text2png;                // 描画の設定
+    int m_jobs;                             // スレッド数
+    VSK_IMAGE_FORMAT m_format;              // 出力の形式
+    std::vector<std::unique_ptr<VskImageWriter> > m_writers; // ワーカーごとのエンコーダー
+    std::mutex m_mutex;                     // m_outputsを保護する
+    std::condition_variable m_cond;         // ページが変換された
+    std::map<int, VskPageOutput> m_outputs; // 書き出し待ちのページ
+    VskThreadPool m_pool;
+    VskPageSink *m_sink = nullptr;          // 出力先
+    FILE *m_log = stdout;                   // 進捗の出力先
+    int m_total_pages = 0;                  // 書き出したページの総数
+    VskStats *m_stats = nullptr;            // 統計（--statsのときだけ）
+    VskPageCache *m_cache = nullptr;        // ページのキャッシュ（--cache-dirのときだけ）
+    bool m_dedupe = true;                   // 同じ内容のページを変換し直さずに使い回すか？
+    bool m_report_duplicates = false;       // 使い回したページを報告するか？
+    bool m_multipage = false;               // 入力ファイルごとに複数ページのTIFFを1つ作るか？
+    VskMultiPageTiff m_tiff;                // 作成中の複数ページのTIFF
+    VSK_ENCODING m_encoding = VSK_ENCODING_SJIS; // 入力の文字コード
+    std::unordered_multimap<VskDwordLong, int> m_page_hashes; // セルのハッシュ値からページ番号を引く
+    std::map<int, VskUniquePage> m_unique_pages;            // 重複を調べるページ（入力ファイルごと）
+    size_t m_unique_bytes = 0;              // m_unique_pagesが保持する画像ファイルのバイト数
+
+    VskConverter(const VskTextToPng& text2png, int jobs, VSK_IMAGE_FORMAT format, bool gray, int png_level,
+                 VskThreadPool *deflate_pool)
+        : m_text2png(text2png)
+        , m_jobs(jobs)
+        , m_format(format)
+        , m_pool(jobs)
+    {
+        for (int i = 0; i < jobs; ++i)
+        {
+            if (format == VSK_IMAGE_PNG)
+            {
+                auto png = new VskPngWriter;
+                png->m_format = gray ? VSK_PNG_GRAY1 : VSK_PNG_PALETTE1;
+                png->set_level(png_level);
+                png->m_pool = deflate_pool; // ページのプールで待つとデッドロックするので別のプールを使う
+                m_writers.emplace_back(png);
+            }
+            else if (format == VSK_IMAGE_TIFF)
+            {
+                m_writers.emplace_back(new VskTiffWriter);
+            }
+            else
+            {
+                auto pnm = new VskPnmWriter;
+                pnm->m_gray = (format == VSK_IMAGE_PGM);
+                m_writers.emplace_back(pnm);
+            }
+        }
+    }
+
+    // inputを変換して、prefix-1.png, prefix-2.png, ...として出力する（複数ページのTIFFならprefix.tif）
+    bool convert(const std::string& input, const std::string& prefix);
+
+protected:
+    // 出力済みのファイルをリンクせず、ページのデータを手元に置くか？
+    bool keep_data() const
+    {
+        return !m_sink->can_link() || m_multipage;
+    }
+
+    void convert_page(int worker, std::string_view text, VskPageOutput& output);
+    int find_same_page(int page, std::string_view text, const std::shared_ptr<std::string>& owned);
+};
 
-    // PNGエンコーダのCLSIDを取得
-    CLSID clsid;
-    if (!GetEncoderClsid(&clsid, mime_type))
-        return FALSE; // 失敗
+// 同じ内容のページを保持する上限。ページ数と、リンクできないときの画像ファイルのデータ量
+#define VSK_MAX_UNIQUE_PAGES 4096
+#define VSK_MAX_UNIQUE_BYTES (64 * 1024 * 1024)
 
-    // PNGとして保存
-    if (pBitmap->Save(filename, &clsid, NULL) != Gdiplus::Ok)
-        return FALSE; // 失敗
+// 前に同じセルのページがあればその番号を返す。なければこのページを覚えて0を返す
+int VskConverter::find_same_page(int page, std::string_view text, const std::shared_ptr<std::string>& owned)
+{
+    std::vector<VskDword> cells, other;
+    vsk_page_cells(m_text2png, text, cells);
+    VskDwordLong hash = vsk_hash_cells(cells);
 
-    return TRUE; // 成功
+    // ハッシュ値が一致したらセルを比べて確かめる
+    auto range = m_page_hashes.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        vsk_page_cells(m_text2png, m_unique_pages[it->second].m_text, other);
+        if (other.size() == cells.size() &&
+            std::memcmp(other.data(), cells.data(), cells.size() * sizeof(VskDword)) == 0)
+        {
+            return it->second;
+        }
+    }
+
+    if (m_unique_pages.size() < VSK_MAX_UNIQUE_PAGES &&
+        (!keep_data() || m_unique_bytes < VSK_MAX_UNIQUE_BYTES))
+    {
+        VskUniquePage& unique = m_unique_pages[page];
+        unique.m_text = text;
+        unique.m_owned = owned;
+        m_page_hashes.emplace(hash, page);
+    }
+    return 0;
 }
 
-// スクリーンショットを保存する
-bool vsk_save_screenshot(HBITMAP hbm, const char *out_filename)
+// 1ページを変換する（ワーカーから呼ばれる）
+void VskConverter::convert_page(int worker, std::string_view text, VskPageOutput& output)
 {
-    // GDI+を初期化
-    Gdiplus::GdiplusStartupInput gdiplusStartupInput;
-    ULONG_PTR gdiplusToken;
-    Gdiplus::GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL);
+    // キャッシュにあれば描画も圧縮もしない。ファイルに出力するならエントリーをリンクする
+    std::string key;
+    if (m_cache)
+    {
+        key = m_cache->key(text);
+        bool hit;
+        if (keep_data())
+            hit = m_cache->load(key, output.m_data);
+        else
+            hit = m_cache->find(key, output.m_cache_path, output.m_cache_size);
+        if (m_stats)
+            ++(hit ? m_stats->m_cache_hits : m_stats->m_cache_misses);
+        if (hit)
+        {
+            if (m_stats)
+                vsk_count_glyphs(m_text2png, text, *m_stats, true);
+            output.m_ok = true;
+            return;
+        }
+        output.m_cache_path.clear();
+        output.m_data.clear(); // 読み込みかけのエントリーは捨てる
+    }
 
-    WCHAR szFileW[MAX_PATH];
-    ::MultiByteToWideChar(932, 0, out_filename, -1, szFileW, MAX_PATH);
-    szFileW[MAX_PATH - 1] = 0;
+    // 文字の行ごとの帯に描画して、すぐに画像の行として符号化する。ページ全体のイメージは作らない
+    int cx, cy;
+    vsk_get_page_size(m_text2png, cx, cy);
+    VskImageWriter& writer = *m_writers[worker];
+    VskDwordLong start_ns = 0, start_cpu_ns = 0, encode_ns = 0, encode_cpu_ns = 0;
+    if (m_stats)
+    {
+        start_ns = vsk_now_ns();
+        start_cpu_ns = vsk_thread_cpu_ns();
+    }
+    writer.begin(cx, cy, output.m_data);
+    output.m_ok = vsk_render_page_text_strips(m_text2png, text,
+        [&](int top, const VskPixelBuffer& strip, const VskByte *ink_rows) {
+            VskDwordLong ns = 0, cpu_ns = 0;
+            if (m_stats)
+            {
+                ns = vsk_now_ns();
+                cpu_ns = vsk_thread_cpu_ns();
+            }
+            for (int y = 0; y < strip.m_height; ++y)
+            {
+                if (ink_rows[y])
+                    writer.write_row(strip.row(y));
+                else
+                    writer.write_blank_row();
+            }
+            if (m_stats)
+            {
+                encode_ns += vsk_now_ns() - ns;
+                encode_cpu_ns += vsk_thread_cpu_ns() - cpu_ns;
+            }
+            return true;
+        });
+    if (output.m_ok)
+    {
+        // 並列に圧縮するときは残りの帯の圧縮をここで待つので、圧縮の時間に含める
+        VskDwordLong ns = 0, cpu_ns = 0;
+        if (m_stats)
+        {
+            ns = vsk_now_ns();
+            cpu_ns = vsk_thread_cpu_ns();
+        }
+        writer.end();
+        if (m_stats)
+        {
+            encode_ns += vsk_now_ns() - ns;
+            encode_cpu_ns += vsk_thread_cpu_ns() - cpu_ns;
+        }
+    }
+    const VskDwordLong helper_cpu_ns = writer.take_helper_cpu_ns();
+    if (m_stats)
+    {
+        // 描画と圧縮は交互に行うので、全体から圧縮の時間を引いたものを描画の時間とする。
+        // 圧縮スレッドのCPU時間は圧縮の時間にだけ加える
+        VskDwordLong ns = vsk_now_ns(), cpu_ns = vsk_thread_cpu_ns();
+        m_stats->add_time(VSK_STAGE_RASTER, ns - start_ns - encode_ns, cpu_ns - start_cpu_ns - encode_cpu_ns);
+        m_stats->add_time(VSK_STAGE_ENCODE, encode_ns, encode_cpu_ns + helper_cpu_ns);
+        if (output.m_ok)
+        {
+            m_stats->m_raw_bytes += VskDwordLong((cx + CHAR_BIT - 1) / CHAR_BIT) * cy;
+            m_stats->m_encoded_bytes += output.m_data.size();
+        }
+    }
+    if (m_stats)
+        vsk_count_glyphs(m_text2png, text, *m_stats, false);
 
-    // 画像ファイルとして保存
-    SaveHBITMAPToFile(hbm, szFileW, L"image/png");
+    // キャッシュに書けなくても変換は続ける
+    if (m_cache && output.m_ok)
+    {
+        VskStageTimer timer(m_stats, VSK_STAGE_WRITE);
+        m_cache->store(key, output.m_data);
+    }
+}
 
-    // GDI+を解放
-    Gdiplus::GdiplusShutdown(gdiplusToken);
+// inputを変換して、prefix-1.png, prefix-2.png, ...として出力する（複数ページのTIFFならprefix.tif）
+bool VskConverter::convert(const std::string& input, const std::string& prefix)
+{
+    VskInputStats input_stats;
+    input_stats.m_name = input;
+    const VskDwordLong start_ns = m_stats ? vsk_now_ns() : 0;
 
-    // HBITMAPを破棄
-    ::DeleteObject(hbm);
+    // 入力ファイルはできるだけメモリーマップし、全体をコピーしない
+    VskInputFile fin;
+    bool opened;
+    {
+        VskStageTimer timer(m_stats, VSK_STAGE_READ);
+        opened = fin.open(input.c_str(), m_encoding);
+    }
+    if (!opened)
+    {
+        fprintf(stderr, "LINE2PNG: Cannot open file '%s'\n", input.c_str());
+        return false;
+    }
 
+    // ページは切り出せた順にすぐ変換を始める
+    VskPageReader reader(fin, m_text2png.m_max_x, m_text2png.m_max_y);
+    reader.m_stats = m_stats;
+    const int max_in_flight = 2 * m_jobs + 2; // メモリー使用量を抑えるため、先行するページ数を制限する
+    int submitted = 0, num_pages = 0;
+    bool failed = false, eof = false;
+    for (;;)
+    {
+        for (; !eof && submitted < num_pages + max_in_flight; ++submitted)
+        {
+            std::string_view page_text;
+            std::shared_ptr<std::string> owned;
+            if (!reader.next(page_text, owned))
+            {
+                eof = true;
+                break;
+            }
+            input_stats.m_bytes_in += page_text.size();
+
+            int page = submitted + 1;
+            if (m_dedupe)
+            {
+                // 同じ内容のページは変換せず、書き出すときに前のページを使い回す
+                int same_as = find_same_page(page, page_text, owned);
+                if (same_as)
+                {
+                    if (m_stats)
+                        vsk_count_glyphs(m_text2png, page_text, *m_stats, true);
+                    VskPageOutput output;
+                    output.m_ok = true;
+                    output.m_same_as = same_as;
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_outputs[page] = std::move(output);
+                    continue;
+                }
+            }
+            m_pool.submit([this, page, page_text, owned](int worker) {
+                VskPageOutput output;
+                convert_page(worker, page_text, output);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_outputs[page] = std::move(output);
+                m_cond.notify_all();
+            });
+        }
+        if (num_pages == submitted)
+            break;
+
+        // ワーカーが変換したページをページ番号順に書き出す
+        int ipage = num_pages + 1;
+        VskPageOutput output;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&]() { return m_outputs.count(ipage) > 0; });
+            output = std::move(m_outputs[ipage]);
+            m_outputs.erase(ipage);
+        }
+
+        std::string out_filename = prefix + "-" + std::to_string(ipage) + vsk_image_format_extension(m_format);
+        if (!output.m_ok)
+        {
+            fprintf(stderr, "LINE2PNG: Cannot render page %d\n", ipage);
+            failed = true;
+            break;
+        }
+        bool written;
+        VskDwordLong out_size = output.m_cache_path.empty() ? output.m_data.size() : output.m_cache_size;
+        {
+            VskStageTimer timer(m_stats, VSK_STAGE_WRITE);
+            if (m_multipage)
+            {
+                // ページはTIFFに追加しておき、入力ファイルの最後にまとめて書き出す
+                if (output.m_same_as)
+                    written = m_tiff.append(m_unique_pages[output.m_same_as].m_data);
+                else
+                    written = m_tiff.append(output.m_data);
+            }
+            else if (output.m_same_as)
+            {
+                const VskUniquePage& unique = m_unique_pages[output.m_same_as];
+                if (m_sink->can_link())
+                    written = m_sink->link_page(ipage, out_filename.c_str(), unique.m_name);
+                else
+                    written = m_sink->write_page(ipage, out_filename.c_str(), unique.m_data);
+                out_size = unique.m_size;
+            }
+            else if (output.m_cache_path.empty())
+            {
+                written = m_sink->write_page(ipage, out_filename.c_str(), output.m_data);
+            }
+            else
+            {
+                written = m_sink->link_page(ipage, out_filename.c_str(), output.m_cache_path);
+            }
+        }
+        if (!written)
+        {
+            fprintf(stderr, "LINE2PNG: Cannot write file '%s'\n", out_filename.c_str());
+            failed = true;
+            break;
+        }
+
+        if (output.m_same_as)
+        {
+            if (m_report_duplicates)
+                fprintf(m_log, "Page %d is the same as page %d.\n", ipage, output.m_same_as);
+            if (m_stats)
+                ++m_stats->m_duplicate_pages;
+        }
+        else
+        {
+            // 後のページが使い回せるよう、出力したファイル名かデータを覚えておく
+            auto it = m_unique_pages.find(ipage);
+            if (it != m_unique_pages.end())
+            {
+                it->second.m_name = out_filename;
+                it->second.m_size = out_size;
+                if (keep_data())
+                {
+                    it->second.m_data = std::move(output.m_data);
+                    m_unique_bytes += it->second.m_data.size();
+                }
+            }
+        }
+
+        if (!m_multipage)
+        {
+            fprintf(m_log, "Generated %s.\n", out_filename.c_str());
+            input_stats.m_bytes_out += out_size;
+        }
+        ++num_pages;
+    }
+
+    if (!failed && fin.failed())
+    {
+        fprintf(stderr, "LINE2PNG: Cannot read file '%s'\n", input.c_str());
+        failed = true;
+    }
+
+    // 複数ページのTIFFは全ページがそろってから書き出す
+    if (m_multipage && !failed && num_pages)
+    {
+        std::string out_filename = prefix + vsk_image_format_extension(m_format);
+        bool written;
+        {
+            VskStageTimer timer(m_stats, VSK_STAGE_WRITE);
+            written = m_sink->write_page(1, out_filename.c_str(), m_tiff.m_data);
+        }
+        if (written)
+        {
+            fprintf(m_log, "Generated %s.\n", out_filename.c_str());
+            input_stats.m_bytes_out += m_tiff.m_data.size();
+        }
+        else
+        {
+            fprintf(stderr, "LINE2PNG: Cannot write file '%s'\n", out_filename.c_str());
+            failed = true;
+        }
+    }
+    m_tiff.clear();
+
+    // 失敗したときは残りのページを待って捨てる
+    m_pool.wait();
+    m_outputs.clear();
+    m_page_hashes.clear();
+    m_unique_pages.clear();
+    m_unique_bytes = 0;
+    m_total_pages += num_pages;
+
+    if (m_stats)
+    {
+        input_stats.m_pages = num_pages;
+        input_stats.m_seconds = double(vsk_now_ns() - start_ns) / 1e9;
+        m_stats->m_inputs.push_back(input_stats);
+    }
+    return !failed;
+}
+
+// 一覧ファイルから入力ファイルを追加する（1行に1つ）
+bool vsk_read_list_file(const std::string& filename, std::vector<std::string>& inputs)
+{
+    FILE *fp = (filename == "-") ? stdin : fopen(filename.c_str(), "r");
+    if (!fp)
+        return false;
+    char buf[1024];
+    while (fgets(buf, sizeof(buf), fp))
+    {
+        std::string line = buf;
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        if (!line.empty())
+            inputs.push_back(line);
+    }
+    if (fp != stdin)
+        fclose(fp);
     return true;
 }
 
+// 入力ファイルに対応する出力ファイル名の接頭辞（拡張子を除いたファイル名）
+std::string vsk_output_prefix(const std::string& input)
+{
+    std::filesystem::path path(input);
+    std::string stem = path.stem().string();
+    return stem.empty() ? "output" : stem;
+}
+
 int main(int argc, char **argv)
 {
     if (argc <= 1)
@@ -699,10 +1612,19 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    std::string input;
+    std::vector<std::string> inputs;
+    std::string output_name, prefix;
+    bool tar = false;
     int margin = 16, max_x = 120, max_y = 80;
     bool is_8801 = false;
     bool bold = false;
+    bool gray = false, multipage = false;
+    VSK_IMAGE_FORMAT format = VSK_IMAGE_PNG;
+    int jobs = 1, deflate_jobs = 1, png_level = 6;
+    bool stats_text = false;
+    bool dedupe = true, report_duplicates = false;
+    VSK_ENCODING encoding = VSK_ENCODING_SJIS;
+    std::string stats_json, cache_dir;
     for (int iarg = 1; iarg < argc; ++iarg)
     {
         std::string arg = argv[iarg];
@@ -750,11 +1672,130 @@ int main(int argc, char **argv)
             bold = true;
             continue;
         }
+        if (arg == "--gray")
+        {
+            gray = true;
+            continue;
+        }
+        if (arg == "--format")
+        {
+            if (++iarg < argc && !vsk_parse_image_format(argv[iarg], format))
+            {
+                fprintf(stderr, "LINE2PNG: Invalid format '%s'\n", argv[iarg]);
+                return 1;
+            }
+            continue;
+        }
+        if (arg == "--multipage")
+        {
+            multipage = true;
+            continue;
+        }
+        if (arg == "--jobs")
+        {
+            if (++iarg < argc)
+            {
+                jobs = atoi(argv[iarg]);
+            }
+            continue;
+        }
+        if (arg == "--deflate-jobs")
+        {
+            if (++iarg < argc)
+            {
+                deflate_jobs = atoi(argv[iarg]);
+            }
+            continue;
+        }
+        if (arg == "--png-level")
+        {
+            if (++iarg < argc)
+            {
+                char *end;
+                png_level = int(strtol(argv[iarg], &end, 10));
+                if (end == argv[iarg] || *end || png_level < 0 || png_level > 9)
+                {
+                    fprintf(stderr, "LINE2PNG: Invalid PNG level '%s'\n", argv[iarg]);
+                    return 1;
+                }
+            }
+            continue;
+        }
+        if (arg == "--no-dedupe")
+        {
+            dedupe = false;
+            continue;
+        }
+        if (arg == "--report-duplicates")
+        {
+            report_duplicates = true;
+            continue;
+        }
+        if (arg == "--cache-dir")
+        {
+            if (++iarg < argc)
+            {
+                cache_dir = argv[iarg];
+            }
+            continue;
+        }
+        if (arg == "--stats")
+        {
+            stats_text = true;
+            continue;
+        }
+        if (arg == "--stats-json")
+        {
+            if (++iarg < argc)
+            {
+                stats_json = argv[iarg];
+            }
+            continue;
+        }
+        if (arg == "-o")
+        {
+            if (++iarg < argc)
+            {
+                output_name = argv[iarg];
+            }
+            continue;
+        }
+        if (arg == "--tar")
+        {
+            tar = true;
+            continue;
+        }
         if (arg == "-i")
         {
             if (++iarg < argc)
             {
-                input = argv[iarg];
+                inputs.push_back(argv[iarg]);
+            }
+            continue;
+        }
+        if (arg == "--list")
+        {
+            if (++iarg < argc && !vsk_read_list_file(argv[iarg], inputs))
+            {
+                fprintf(stderr, "LINE2PNG: Cannot open file '%s'\n", argv[iarg]);
+                return 1;
+            }
+            continue;
+        }
+        if (arg == "--encoding")
+        {
+            if (++iarg < argc && !vsk_parse_encoding(argv[iarg], encoding))
+            {
+                fprintf(stderr, "LINE2PNG: Invalid encoding '%s'\n", argv[iarg]);
+                return 1;
+            }
+            continue;
+        }
+        if (arg == "--prefix")
+        {
+            if (++iarg < argc)
+            {
+                prefix = argv[iarg];
             }
             continue;
         }
@@ -762,46 +1803,169 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    if (input.empty())
+    // ディレクトリはその中のファイルに展開する
+    std::vector<std::string> files;
+    for (auto& input : inputs)
+    {
+        std::error_code ec;
+        if (input == "-" || !std::filesystem::is_directory(input, ec))
+        {
+            files.push_back(input);
+            continue;
+        }
+        std::vector<std::string> entries;
+        for (auto& entry : std::filesystem::directory_iterator(input, ec))
+        {
+            if (entry.is_regular_file(ec))
+                entries.push_back(entry.path().string());
+        }
+        std::sort(entries.begin(), entries.end());
+        files.insert(files.end(), entries.begin(), entries.end());
+    }
+
+    if (files.empty())
     {
         fprintf(stderr, "LINE2PNG: No input file specified\n");
         return 1;
     }
 
-    FILE *fin = fopen(input.c_str(), "rb");
-    char buf[256];
-    std::string text;
-    while (fgets(buf, 256, fin))
+    if (multipage && format != VSK_IMAGE_TIFF)
     {
-        text += buf;
+        fprintf(stderr, "LINE2PNG: --multipage needs --format tiff\n");
+        return 1;
+    }
+
+    // 統計は入力の展開や出力先の準備も含めて測る
+    std::unique_ptr<VskStats> stats;
+    if (stats_text || !stats_json.empty())
+    {
+        stats.reset(new VskStats);
+        stats->begin();
+    }
+
+    // 出力先。-oがなければページごとにファイルを作る
+    std::unique_ptr<VskPageSink> sink;
+    FILE *log = stdout;
+    if (output_name.empty())
+    {
+        sink.reset(new VskFileSink);
+    }
+    else
+    {
+        auto stream = tar ? new VskTarSink : new VskStreamSink;
+        sink.reset(stream);
+        if (!stream->open(output_name.c_str()))
+        {
+            fprintf(stderr, "LINE2PNG: Cannot open file '%s'\n", output_name.c_str());
+            return 1;
+        }
+        if (output_name == "-")
+            log = stderr; // 標準出力はデータ専用にする
     }
-    fclose(fin);
 
     VskTextToPng text2png;
-    text2png.m_text = text;
     text2png.m_max_x = max_x;
     text2png.m_max_y = max_y;
     text2png.m_margin = margin;
-    text2png.m_page = 0;
     text2png.m_is_8801 = is_8801;
     text2png.m_bold = bold;
-    vsk_text_to_bitmap(text2png);
+    text2png.m_bpp = 1; // 画像の行をそのまま渡せるように1BPPで描画する
+
+    if (jobs <= 0)
+        jobs = std::max(1, int(std::thread::hardware_concurrency()));
+
+    // 1ページの圧縮を複数のスレッドに分ける
+    if (deflate_jobs <= 0)
+        deflate_jobs = std::max(1, int(std::thread::hardware_concurrency()));
+    std::unique_ptr<VskThreadPool> deflate_pool;
+    if (deflate_jobs > 1)
+        deflate_pool.reset(new VskThreadPool(deflate_jobs));
+
+    VskConverter converter(text2png, jobs, format, gray, png_level, deflate_pool.get());
+    converter.m_sink = sink.get();
+    converter.m_log = log;
+    converter.m_stats = stats.get();
+    converter.m_dedupe = dedupe;
+    converter.m_report_duplicates = report_duplicates;
+    converter.m_multipage = multipage;
+    converter.m_encoding = encoding;
+
+    // キャッシュのキーには出力を左右する設定をすべて含める
+    VskPageCache cache;
+    if (!cache_dir.empty())
+    {
+        char salt[256];
+        const char *format_name = vsk_image_format_name(format);
+        if (format == VSK_IMAGE_PNG)
+            format_name = gray ? "gray1" : "palette1";
+        std::snprintf(salt, sizeof(salt), "max_x=%d\nmax_y=%d\nmargin=%d\n8801=%d\nbold=%d\nformat=%s\nlevel=%d",
+                      max_x, max_y, margin, int(is_8801), int(bold), format_name,
+                      (format == VSK_IMAGE_PNG) ? png_level : 0);
+        if (!cache.open(cache_dir, salt))
+        {
+            fprintf(stderr, "LINE2PNG: Cannot open cache directory '%s'\n", cache_dir.c_str());
+            return 1;
+        }
+        cache.m_format = format;
+        converter.m_cache = &cache;
+    }
 
-    int num_pages = text2png.m_total_pages;
-    for (int ipage = 1; ipage <= num_pages; ++ipage)
+    // 入力ファイルが1つなら出力はoutput-N.png、複数なら入力ファイル名-N.png（拡張子は形式による）
+    bool failed = false;
+    for (auto& file : files)
     {
-        char out_filename[MAX_PATH];
-        std::sprintf(out_filename, "output-%u.png", ipage);
+        std::string file_prefix = prefix;
+        if (file_prefix.empty())
+            file_prefix = (files.size() == 1) ? "output" : vsk_output_prefix(file);
+        else if (files.size() > 1)
+            file_prefix += vsk_output_prefix(file);
+        if (!converter.convert(file, file_prefix))
+            failed = true;
+    }
 
-        text2png.m_page = ipage;
-        vsk_text_to_bitmap(text2png);
-        vsk_save_screenshot(text2png.m_hbm, out_filename);
-        DeleteObject(text2png.m_hbm);
+    bool finished;
+    {
+        VskStageTimer timer(stats.get(), VSK_STAGE_WRITE);
+        finished = sink->finish();
+    }
+    if (!finished)
+    {
+        fprintf(stderr, "LINE2PNG: Cannot write file '%s'\n", output_name.c_str());
+        failed = true;
+    }
 
-        printf("Generated %s.\n", out_filename);
+    // 統計は失敗したときも出力する（遅い入力や失敗した入力を調べるため）
+    if (stats)
+    {
+        stats->m_jobs = jobs;
+        stats->m_format = vsk_image_format_name(format);
+        stats->m_png_level = png_level;
+        stats->end();
+        if (stats_text)
+            stats->print_text(log);
+        if (!stats_json.empty())
+        {
+            FILE *fp = (stats_json == "-") ? log : fopen(stats_json.c_str(), "w");
+            if (!fp)
+            {
+                fprintf(stderr, "LINE2PNG: Cannot open file '%s'\n", stats_json.c_str());
+                failed = true;
+            }
+            else
+            {
+                stats->print_json(fp);
+                if (fp != log && fclose(fp) != 0)
+                {
+                    fprintf(stderr, "LINE2PNG: Cannot write file '%s'\n", stats_json.c_str());
+                    failed = true;
+                }
+            }
+        }
     }
+    if (failed)
+        return 1;
 
-    printf("Total %d pages\n", num_pages);
+    fprintf(log, "Total %d pages\n", converter.m_total_pages);
     return 0;
 }
 
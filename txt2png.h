@@ -1,18 +1,103 @@
 #pragma once
 
 #include "types.h"
+#include "framebuffer.h"
+#include <string_view>
+#include <functional>
+
+// ページの開始位置
+struct VskPageStart
+{
+    size_t m_offset = 0;        // テキスト中のバイトオフセット
+    VskByte m_lead = 0;         // 保留中のSJISリードバイト
+    bool m_was_lead = false;    // リードバイトが保留中か？
+    int m_x = 0;                // カーソルの桁
+};
 
 struct VskTextToPng
 {
     int m_total_pages = 0;
-    std::string m_text;
+    std::string_view m_text;    // テキスト（所有しない。描画中は呼び出し側が保持すること）
     int m_max_x = 120;
     int m_max_y = 80;
     int m_margin = 16;
     int m_page = 1;
     bool m_is_8801 = false;
     bool m_bold = false;
+    int m_bpp = 32;             // 描画先のビットの深さ（32、8、1。ピクセルの形式はVskFrameBufferと同じ）
     VskImageHandle m_hbm = nullptr;
+    std::vector<VskPageStart> m_page_starts; // ページ索引（vsk_paginateが作成）
+};
+
+// 少しずつ与えられたテキストから改ページ位置を探す。
+// ページはかならず改行の直後で始まるので、状態はページごとにリセットされる
+struct VskPaginator
+{
+    int m_max_x = 120;          // 桁数
+    int m_max_y = 80;           // 行数
+    int m_x = 0;                // カーソルの桁
+    int m_y = 0;                // カーソルの行
+    bool m_was_lead = false;    // SJISリードバイトが保留中か？
+
+    VskPaginator(int max_x, int max_y) : m_max_x(max_x), m_max_y(max_y) { }
+
+    // ページの先頭に戻す
+    void reset();
+    // textを走査する。改ページしたらその改行の次までのバイト数をusedに格納してtrueを返す。
+    // 改ページしなければusedはtextの長さになり、状態は次の呼び出しに引き継がれる
+    bool feed(std::string_view text, size_t& used);
 };
 
+// テキストを一度だけ走査してページ索引を作成する
+bool vsk_paginate(VskTextToPng& text2png);
+
 bool vsk_text_to_bitmap(VskTextToPng& text2png);
+
+struct VskGlyphCache;
+
+// ページ索引を使ってpage番目のページを描画する。text2pngを変更しないので複数のスレッドから呼べる。
+// imageが同じ大きさならそれを再利用し、そうでなければ作り直す。
+// cacheを省略するとスレッドごとのグリフキャッシュを使う
+bool vsk_render_page(const VskTextToPng& text2png, int page, VskImageHandle& image,
+                     VskGlyphCache *cache = nullptr);
+// textの先頭から1ページ分を描画する。text2pngのテキストとページ索引は使わない
+bool vsk_render_page_text(const VskTextToPng& text2png, std::string_view text, VskImageHandle& image,
+                          VskGlyphCache *cache = nullptr);
+
+// ページの大きさ（ピクセル単位）を取得する
+void vsk_get_page_size(const VskTextToPng& text2png, int& cx, int& cy);
+
+// ページ索引を使ってpage番目のページを呼び出し側のバッファに描画する。
+// バッファのビットの深さはtext2png.m_bppでなくbuffer.m_bppを使う。
+// バッファはページの大きさ以上であること（はみ出す部分には描画しない）
+bool vsk_render_page_to_buffer(const VskTextToPng& text2png, int page, const VskPixelBuffer& buffer,
+                               VskGlyphCache *cache = nullptr);
+// textの先頭から1ページ分を呼び出し側のバッファに描画する
+bool vsk_render_page_text_to_buffer(const VskTextToPng& text2png, std::string_view text,
+                                    const VskPixelBuffer& buffer, VskGlyphCache *cache = nullptr);
+// textの先頭から1ページ分を、文字の行がfirst_row以降の部分だけ描画し直す。
+// first_row行目より上のピクセルはそのまま残すので、bufferにはその行まで同じ内容のページが描画されていること
+bool vsk_render_page_text_rows(const VskTextToPng& text2png, std::string_view text, int first_row,
+                               const VskPixelBuffer& buffer, VskGlyphCache *cache = nullptr);
+
+// 描画した帯を受け取るコールバック。stripはページのtop行目からの帯で、呼び出しの間だけ有効。
+// ink_rowsは帯の行ごとのインクの有無（0なら白い行）。falseを返すと中止する
+typedef std::function<bool(int top, const VskPixelBuffer& strip, const VskByte *ink_rows)> VskStripCallback;
+// textの先頭から1ページ分を、上から文字の行の高さ（20ピクセル）ずつの帯に描画してon_stripに渡す。
+// 帯はページの全体を上から順に覆う。帯のバッファはスレッドごとに使い回すので、
+// 必要なメモリーはページの高さによらない
+bool vsk_render_page_text_strips(const VskTextToPng& text2png, std::string_view text,
+                                 const VskStripCallback& on_strip, VskGlyphCache *cache = nullptr);
+
+// 描画したページを受け取るコールバック。falseを返すと中止する。bufferは呼び出しの間だけ有効
+typedef std::function<bool(int page, const VskPixelBuffer& buffer)> VskPageCallback;
+// 描画した行を受け取るコールバック。falseを返すと中止する。rowは呼び出しの間だけ有効
+typedef std::function<bool(int page, int y, const VskByte *row)> VskRowCallback;
+
+// text2png.m_textの全ページをtext2png.m_bppで描画し、1ページごとにon_pageを呼ぶ。
+// ページ索引は不要で、バッファはページ間で使い回す
+bool vsk_render_pages(const VskTextToPng& text2png, const VskPageCallback& on_page,
+                      VskGlyphCache *cache = nullptr);
+// text2png.m_textの全ページを描画し、上から順に1行ずつon_rowを呼ぶ
+bool vsk_render_rows(const VskTextToPng& text2png, const VskRowCallback& on_row,
+                     VskGlyphCache *cache = nullptr);